@@ -1,4 +1,4 @@
-// gcc -fopenmp MCpi_sequencial.c -o MCpi_sequencial.exe
+// gcc -fopenmp MCpi_sequencial.c ../mchits.c -o MCpi_sequencial.exe
 // 
 // srun -N 1 -n 1 --exclusive MCpi_sequencial.exe
 // [SEQUENCIAL] Iniciando cálculo de PI com 10000000000 pontos...
@@ -10,37 +10,45 @@
 #include <stdlib.h>
 #include <math.h>
 #include <time.h>
+#include "../mchits.h"
 
 #define SEED 314159
 
+// mesmo tamanho do paralelo (e as mesmas opções de compilação -DBASE_TASKS / -DPOINTS_PER_TASK)
+#ifndef BASE_TASKS
+#define BASE_TASKS 10000
+#endif
+#ifndef POINTS_PER_TASK
+#define POINTS_PER_TASK 1000000
+#endif
+
 int main(int argc, char* argv[]) {
-    long total_tasks = 10000;        // número de blocos (mesmo do paralelo)
-    long points_per_task = 1000000;  // pontos por bloco
+    long total_tasks = BASE_TASKS;           // número de blocos (mesmo do paralelo)
+    long points_per_task = POINTS_PER_TASK;  // pontos por bloco
     long total_points = total_tasks * points_per_task;
     long total_in_circle = 0;
 
-    srand(SEED);
+    const char* isa = mcInit();
 
+    printf("[SEQUENCIAL] Kernel: %s\n", isa);
     printf("[SEQUENCIAL] Iniciando cálculo de PI com %ld pontos...\n", total_points);
 
-    time_t tempo_inicial = time(NULL);
+    // relógio monotônico com frações de segundo, para comparar com o MPI_Wtime do paralelo
+    struct timespec tempo_inicial, tempo_final;
+    clock_gettime(CLOCK_MONOTONIC, &tempo_inicial);
 
-    for (long t = 0; t < total_tasks; t++) {
-        for (long i = 0; i < points_per_task; i++) {
-            double x = (double)rand() / RAND_MAX;
-            double y = (double)rand() / RAND_MAX;
-            if (x*x + y*y <= 1.0)
-                total_in_circle++;
-        }
-    }
+    // mesmas tarefas e mesmos pontos do paralelo, logo o mesmo PI
+    for (long t = 0; t < total_tasks; t++)
+        total_in_circle += mcHits(SEED, t, points_per_task);
 
-    time_t tempo_final = time(NULL);
-    long duracao = tempo_final - tempo_inicial;
+    clock_gettime(CLOCK_MONOTONIC, &tempo_final);
+    double duracao = (tempo_final.tv_sec - tempo_inicial.tv_sec) + (tempo_final.tv_nsec - tempo_inicial.tv_nsec) * 1e-9;
 
     double pi = 4.0 * ((double)total_in_circle / (double)total_points);
 
     printf("[SEQUENCIAL] PI ≈ %.6f\n", pi);
-    printf("[SEQUENCIAL] Tempo total (T1) = %ld segundos\n", duracao);
+    printf("[SEQUENCIAL] Tempo total (T1) = %f segundos\n", duracao);
+    printf("[SEQUENCIAL] %.3e pontos/s\n", (double)total_points / duracao);
 
     return 0;
 }
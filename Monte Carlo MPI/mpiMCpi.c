@@ -1,4 +1,24 @@
-// ladcomp -env mpicc mpiMCpi.c -o mpiMCpi
+// ladcomp -env mpicc mpiMCpi.c ../mchits.c -o mpiMCpi
+// ladcomp -env mpicc -fopenmp mpiMCpi.c ../mchits.c -o mpiMCpi   (modo híbrido, "threads=N")
+//
+// Modo híbrido: com "threads=N" (ou "threads=auto", que usa os núcleos a que o processo está
+// preso ou, sem binding, divide os do nó entre os processos dele) cada trabalhador divide os pontos de cada tarefa entre N threads OpenMP e
+// devolve um único resultado, então basta um processo por nó e o mestre recebe N vezes menos
+// pedidos. O PI continua idêntico ao do MCpi_sequencial.
+// srun -N 4 --ntasks-per-node=1 --cpus-per-task=<núcleos> mpiMCpi threads=auto
+// (o mestre só distribui tarefas; no nó dele rode mais um processo como trabalhador)
+//
+// Saco de tarefas: cada trabalhador mantém "prefetch=D" pedidos (padrão 2) em andamento, então
+// já tem o próximo bloco de tarefas quando termina o atual, e o resultado de cada bloco vai de
+// carona no pedido seguinte. O mestre entrega blocos de tarefas de tamanho guiado (o que falta
+// dividido por 2 x trabalhadores: blocos grandes no começo, de 1 tarefa no fim) ou de tamanho
+// fixo com "chunk=N" ("chunk=1 prefetch=1" é o protocolo antigo, uma tarefa por pedido).
+//
+// Sem mestre: com "dispatch=rma" o índice da próxima tarefa fica numa janela MPI no processo 0
+// e todos os processos, o 0 inclusive, pegam blocos com MPI_Fetch_and_op (soma atômica); os
+// acertos são somados num único MPI_Reduce no fim. Nenhum núcleo fica só distribuindo
+// tarefas e o balanceamento continua dinâmico. Os blocos guiados usam o último índice que o
+// processo viu; "chunk=N" também vale aqui ("prefetch" não se aplica).
 // 
 // SPEED UP FORTE:
 // Executando em 1 máquina (N) com 2 processos no total (n) de forma exclusiva
@@ -46,109 +66,263 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include "mpi.h"
+#include "../mchits.h"
+#ifdef _OPENMP
+#include <omp.h>
+#include <unistd.h>
+#endif
 
 #define SEED 314159
 #define TASK_TAG 2
-#define RESULT_TAG 3
 #define TERMINATE_TAG 4
-#define REQUEST_TAG 1
+#define REQUEST_TAG 1       // pedido de trabalho, com o resultado do bloco anterior
+#define GUIDED_DIVISOR 2    // bloco guiado = tarefas restantes / (GUIDED_DIVISOR * trabalhadores)
+
+// tamanho do problema; pode ser trocado na compilação (-DBASE_TASKS=... -DPOINTS_PER_TASK=...),
+// como faz bench/scaling.py para rodadas locais menores
+#ifndef BASE_TASKS
+#define BASE_TASKS 10000
+#endif
+#ifndef POINTS_PER_TASK
+#define POINTS_PER_TASK 1000000
+#endif
+
+long block_hits(long first, long count, long points_per_task);
 
 int main(int argc, char* argv[]) {
     int myid, numnodes;
     long total_tasks;
-    long base_tasks = 10000;        // número de blocos de trabalho
-    long points_per_task = 1000000;  // número de pontos por bloco
-    long next_task = 0;              // índice do próximo bloco a distribuir
+    long base_tasks = BASE_TASKS;            // número de blocos de trabalho
+    long points_per_task = POINTS_PER_TASK;  // número de pontos por bloco
+    long next_task = 0;              // índice da próxima tarefa a distribuir
     double pi = 0.0;
     double t1, t2;
+    int provided;
     MPI_Status status;
 
-    MPI_Init(&argc, &argv);
+    // só a thread principal chama o MPI; as threads OpenMP apenas contam pontos
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &myid);
     MPI_Comm_size(MPI_COMM_WORLD, &numnodes);
 
-    srand(SEED + myid);
-
-    // Se o usuário passar "weak" como argumento, o problema cresce com numnodes
+    // Se o usuário passar "weak" como argumento, o problema cresce com numnodes;
+    // "threads=N" ou "threads=auto" liga o modo híbrido
     int weak_scaling = 0;
-    if (argc > 1 && strcmp(argv[1], "weak") == 0) {
-        weak_scaling = 1;
+    int threads = 1;
+    int prefetch = 2;       // pedidos em andamento por trabalhador
+    long chunk_size = 0;    // tarefas por bloco (0 = guiado)
+    int rma = 0;            // 1 = contador de tarefas numa janela MPI, sem mestre
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "weak") == 0) {
+            weak_scaling = 1;
+        } else if (strncmp(argv[a], "threads=", 8) == 0) {
+#ifdef _OPENMP
+            if (strcmp(argv[a] + 8, "auto") == 0) {
+                // omp_get_num_procs já conta só os núcleos do cpuset do processo; se ele está
+                // preso (--cpus-per-task, --map-by ...:pe=N) esses núcleos são todos dele,
+                // senão divide os núcleos do nó entre os processos que rodam nele
+                MPI_Comm nodeComm;
+                int ranksPerNode;
+                MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, myid, MPI_INFO_NULL, &nodeComm);
+                MPI_Comm_size(nodeComm, &ranksPerNode);
+                MPI_Comm_free(&nodeComm);
+                if (omp_get_num_procs() < sysconf(_SC_NPROCESSORS_ONLN))
+                    threads = omp_get_num_procs();
+                else
+                    threads = omp_get_num_procs() / ranksPerNode;
+            } else {
+                threads = atoi(argv[a] + 8);
+            }
+            if (threads < 1) threads = 1;
+#else
+            if (myid == 0)
+                printf("Aviso: compilado sem -fopenmp, \"%s\" ignorado\n", argv[a]);
+#endif
+        } else if (strncmp(argv[a], "prefetch=", 9) == 0 && atoi(argv[a] + 9) >= 1) {
+            prefetch = atoi(argv[a] + 9);
+        } else if (strcmp(argv[a], "dispatch=master") == 0 || strcmp(argv[a], "dispatch=rma") == 0) {
+            rma = (strcmp(argv[a], "dispatch=rma") == 0);
+        } else if (strcmp(argv[a], "chunk=guided") == 0) {
+            chunk_size = 0;
+        } else if (strncmp(argv[a], "chunk=", 6) == 0 && atol(argv[a] + 6) >= 1) {
+            chunk_size = atol(argv[a] + 6);
+        } else {
+            if (myid == 0)
+                printf("Uso: mpiMCpi [weak] [threads=N|auto] [prefetch=D] [chunk=guided|N] [dispatch=master|rma]\n");
+            MPI_Finalize();
+            return 1;
+        }
     }
 
+#ifdef _OPENMP
+    // sempre fixa o tamanho da equipe: sem "threads=" o padrão do OpenMP seria uma thread por
+    // núcleo visível em cada processo, o que sobrecarrega o nó no lançamento de um processo por núcleo
+    omp_set_num_threads(threads);
+#endif
+
     if (weak_scaling) {
         total_tasks = base_tasks * numnodes; // cresce com o número de processos
     } else {
         total_tasks = base_tasks;             // fixo (strong scaling)
     }
 
+    const char* isa = mcInit();  // escolhe o kernel (AVX-512, AVX2 ou escalar) antes de medir o tempo
+
+    // total de threads que contam pontos (o mestre só conta no modo rma)
+    int worker_threads = (myid == 0 && !rma) ? 0 : threads, total_threads = 0;
+    MPI_Reduce(&worker_threads, &total_threads, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    long total_in_circle = 0;
+    long chunks = 0;
+
     t1 = MPI_Wtime();  // inicia a contagem do tempo
 
-    if (myid == 0) {
+    if (rma) {
+        // ========== SEM MESTRE ==========
+        MPI_Win win;
+        long* cursor;           // próxima tarefa livre (só existe no processo 0)
+        long hits = 0, my_chunks = 0, seen = 0;
+
+        MPI_Win_allocate(myid == 0 ? sizeof(long) : 0, sizeof(long), MPI_INFO_NULL, MPI_COMM_WORLD, &cursor, &win);
+        if (myid == 0) {
+            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
+            *cursor = 0;
+            MPI_Win_unlock(0, win);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        MPI_Win_lock_all(0, win);
+
+        while (1) {
+            // pega um bloco somando o tamanho dele ao cursor; o valor antigo é a primeira tarefa.
+            // O cursor pode passar de total_tasks: quem recebe um início além do fim terminou.
+            long want = chunk_size ? chunk_size : (total_tasks - seen) / (GUIDED_DIVISOR * numnodes);
+            long first;
+            if (want < 1) want = 1;
+            MPI_Fetch_and_op(&want, &first, MPI_LONG, 0, 0, MPI_SUM, win);
+            MPI_Win_flush(0, win);
+            if (first >= total_tasks)
+                break;
+
+            long count = (want < total_tasks - first) ? want : total_tasks - first;
+            if (myid == 0) {
+                // o processo 0 também calcula; entre uma tarefa e outra ele passa pelo MPI para
+                // que as operações atômicas dos outros avancem em redes sem RMA em hardware
+                for (long task_id = first; task_id < first + count; task_id++) {
+                    hits += block_hits(task_id, 1, points_per_task);
+                    MPI_Win_flush(0, win);
+                }
+            } else {
+                hits += block_hits(first, count, points_per_task);
+            }
+            seen = first + count;
+            my_chunks++;
+        }
+
+        MPI_Win_unlock_all(win);
+        MPI_Reduce(&hits, &total_in_circle, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&my_chunks, &chunks, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Win_free(&win);
+    }
+
+    else if (myid == 0) {
         // ========== MESTRE ==========
-        int active_workers = numnodes - 1;
-        long total_in_circle = 0;
+        int workers = numnodes - 1;
+        // cada pedido recebe uma resposta e cada trabalhador manda um pedido novo por bloco
+        // recebido, então cada um recebe exatamente "prefetch" términos; o último resultado
+        // chega num pedido respondido com término, logo nenhum resultado fica para trás
+        long terminations = (long)workers * prefetch;
 
-        while (active_workers > 0) {
-            int worker_id;
-            MPI_Recv(&worker_id, 1, MPI_INT, MPI_ANY_SOURCE, REQUEST_TAG, MPI_COMM_WORLD, &status);
+        while (terminations > 0) {
+            long result;
+            MPI_Recv(&result, 1, MPI_LONG, MPI_ANY_SOURCE, REQUEST_TAG, MPI_COMM_WORLD, &status);
+            total_in_circle += result;   // resultado do bloco anterior (0 nos primeiros pedidos)
 
             if (next_task < total_tasks) {
-                // Envia uma nova tarefa (um número indicando o bloco)
-                MPI_Send(&next_task, 1, MPI_LONG, status.MPI_SOURCE, TASK_TAG, MPI_COMM_WORLD);
-                next_task++;
+                // Envia um bloco de tarefas: a primeira e quantas são
+                long block[2];
+                block[0] = next_task;
+                block[1] = chunk_size ? chunk_size : (total_tasks - next_task) / (GUIDED_DIVISOR * workers);
+                if (block[1] < 1) block[1] = 1;
+                if (block[1] > total_tasks - next_task) block[1] = total_tasks - next_task;
+                MPI_Send(block, 2, MPI_LONG, status.MPI_SOURCE, TASK_TAG, MPI_COMM_WORLD);
+                next_task += block[1];
+                chunks++;
             } else {
                 // Saco vazio — envia mensagem de término
                 MPI_Send(&next_task, 1, MPI_LONG, status.MPI_SOURCE, TERMINATE_TAG, MPI_COMM_WORLD);
-                active_workers--;
-            }
-
-            // Recebe resultados prontos, se houver
-            int flag;
-            MPI_Iprobe(MPI_ANY_SOURCE, RESULT_TAG, MPI_COMM_WORLD, &flag, &status);
-            while (flag) {
-                long result;
-                MPI_Recv(&result, 1, MPI_LONG, status.MPI_SOURCE, RESULT_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                total_in_circle += result;
-                MPI_Iprobe(MPI_ANY_SOURCE, RESULT_TAG, MPI_COMM_WORLD, &flag, &status);
+                terminations--;
             }
         }
-
-        long total_points = total_tasks * points_per_task;
-        pi = 4.0 * ((double)total_in_circle / (double)total_points);
-        printf("\n[MASTER] PI ≈ %.6f com %ld pontos (%ld tarefas)\n", pi, total_points, total_tasks);
-
-        t2 = MPI_Wtime();  // termina a contagem do tempo
-
-        printf("\nTempo de execucao: %f\n\n", t2 - t1);
     }
 
     else {
         // ========== TRABALHADOR ==========
-        while (1) {
-            // Envia pedido de trabalho
-            MPI_Send(&myid, 1, MPI_INT, 0, REQUEST_TAG, MPI_COMM_WORLD);
+        long hits = 0;       // resultado do último bloco, vai de carona no próximo pedido
+        long block[2];       // primeira tarefa e número de tarefas do bloco recebido
+        int pending;
+
+        // Pedidos adiantados: enquanto calcula um bloco, os próximos já estão a caminho
+        for (pending = 0; pending < prefetch; pending++)
+            MPI_Send(&hits, 1, MPI_LONG, 0, REQUEST_TAG, MPI_COMM_WORLD);
 
-            long task_id;
-            MPI_Recv(&task_id, 1, MPI_LONG, 0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+        while (pending > 0) {
+            MPI_Recv(block, 2, MPI_LONG, 0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+            pending--;
 
             if (status.MPI_TAG == TERMINATE_TAG)
-                break; // encerra o trabalhador
-
-            // Processa a tarefa recebida
-            long count = 0;
-            for (long i = 0; i < points_per_task; i++) {
-                double x = (double)rand() / RAND_MAX;
-                double y = (double)rand() / RAND_MAX;
-                if (x*x + y*y <= 1.0)
-                    count++;
-            }
+                continue; // encerra quando todos os pedidos tiverem resposta
 
-            // Envia resultado de volta ao mestre
-            MPI_Send(&count, 1, MPI_LONG, 0, RESULT_TAG, MPI_COMM_WORLD);
+            hits = block_hits(block[0], block[1], points_per_task);
+
+            // Pede o próximo bloco levando o resultado deste
+            MPI_Send(&hits, 1, MPI_LONG, 0, REQUEST_TAG, MPI_COMM_WORLD);
+            pending++;
         }
     }
 
+    if (myid == 0) {
+        long total_points = total_tasks * points_per_task;
+        pi = 4.0 * ((double)total_in_circle / (double)total_points);
+        printf("\n[%s] PI ≈ %.6f com %ld pontos (%ld tarefas)\n", rma ? "RMA" : "MASTER", pi, total_points, total_tasks);
+
+        t2 = MPI_Wtime();  // termina a contagem do tempo
+
+        printf("\nTempo de execucao: %f\n", t2 - t1);
+        printf("Trabalhadores: %d processos, %d threads no total\n", rma ? numnodes : numnodes - 1, total_threads);
+        if (rma)
+            printf("Blocos: %ld (%s), contador em janela MPI\n", chunks, chunk_size ? "tamanho fixo" : "guiados");
+        else
+            printf("Blocos: %ld (%s), %d pedidos adiantados por trabalhador\n", chunks,
+                   chunk_size ? "tamanho fixo" : "guiados", prefetch);
+        printf("Kernel: %s, %.3e pontos/s por thread\n\n", isa,
+               (double)total_points / (t2 - t1) / (total_threads > 0 ? total_threads : 1));
+    }
+
     MPI_Finalize();
     return 0;
 }
+
+// Conta os acertos das tarefas first..first+count-1. Os pontos vêm do Philox com a tarefa como
+// contador (dependem só do task_id, não de qual processo a executa) e são testados em blocos pelo
+// kernel vetorial de mchits.c. No modo híbrido cada thread conta uma faixa dos pontos de cada
+// tarefa num contador privado (reduction); as faixas começam em múltiplos de 32 pontos para o
+// kernel vetorial não tratar pontas no meio da tarefa.
+long block_hits(long first, long count, long points_per_task) {
+    long hits = 0;
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:hits)
+    {
+        int t = omp_get_thread_num(), nt = omp_get_num_threads();
+        long from = (t == 0) ? 0 : (points_per_task * t / nt) & ~31L;
+        long to = (t == nt - 1) ? points_per_task : (points_per_task * (t + 1) / nt) & ~31L;
+        for (long task_id = first; task_id < first + count; task_id++)
+            hits += mcHitsRange(SEED, task_id, from, to);
+    }
+#else
+    for (long task_id = first; task_id < first + count; task_id++)
+        hits += mcHits(SEED, task_id, points_per_task);
+#endif
+    return hits;
+}
@@ -0,0 +1,322 @@
+#!/usr/bin/env python3
+"""Strong/weak scaling driver for the Monte Carlo, Jacobi and MPI sort programs.
+
+Builds every program into <out>/bin (again whenever a source, a header it
+includes or the compile command changed), runs each one over a matrix of rank
+counts (and problem sizes for the sort), and writes the results to
+<out>/results.json and <out>/results.csv, so scaling tables no longer have
+to be copied by hand from srun sessions.
+
+Speedup and efficiency are measured against:
+  mc      Monte Carlo MPI/MCpi_sequencial.c, built with the same task sizes
+  sort    t3/bbs.c, built with the same array size and -DRANDOM_INPUT, so it
+          sorts the same random array as bubble_balanceado
+  jacobi  the same program on 1 rank (there is no separate sequential Jacobi)
+
+Strong scaling keeps the problem fixed: speedup = T_base / T_N and
+efficiency = speedup / N. Weak scaling grows the problem with N the way
+mpiMCpi's "weak" argument does (tasks * N, mesh rows * N for jacobi and
+jacobi_fases, and array size * N for the sort):
+efficiency = T_base / T_N and the scaled speedup is N * efficiency.
+mpiMCpi rank 0 only hands out tasks, so the mc runs need at least 2 ranks.
+The other Jacobi variants have a fixed mesh, so they are only run in strong mode.
+
+The time used is the one the program prints itself (MPI_Wtime / clock);
+the wall time of the whole launch is recorded next to it.
+
+Examples:
+  # local, small sizes (Open MPI needs --oversubscribe for more ranks than cores)
+  python3 bench/scaling.py --ranks 1,2,4 --launcher-args="--oversubscribe"
+  # cluster, the sizes used for README.md and t4/resultados.txt
+  python3 bench/scaling.py --launcher srun --nodes 2 --ranks 4,8,16,32 \\
+      --mc-tasks 10000 --mc-points 1000000 --jacobi-args "1e-4 7000"
+  # flag runs that got more than 10% slower than an earlier results file
+  python3 bench/scaling.py --compare old/results.json --tolerance 0.10
+"""
+
+import argparse
+import csv
+import datetime
+import json
+import os
+import re
+import shlex
+import socket
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# time lines printed by the programs; the last match in the output wins
+TIME_PATTERNS = [
+    r"took ([0-9.]+) seconds",                       # jacobi.c, jacobi_cart.c, jacobi_hybrid.c, jacobi_mg.c
+    r"Convergência atingida em \d+ iterações \(([0-9.]+) s\)",   # t4/jacobi_fases_paralelas.c
+    r"Tempo de execucao: ([0-9.]+)",                 # mpiMCpi.c
+    r"Tempo total \(T1\) = ([0-9.]+)",               # MCpi_sequencial.c
+    r"Elapsed = ([0-9.]+)",                          # t3/bbs.c, t3/bubble_balanceado.c
+]
+
+# Jacobi variants: program name -> (sources, extra compiler flags, arguments besides the ones from --jacobi-args,
+# whether it takes size= and weak)
+JACOBI_VARIANTS = {
+    "jacobi": (["jacobi.c", "stencil.c", "timing.c"], [], ["output=none"], True),
+    "jacobi_fases": (["t4/jacobi_fases_paralelas.c", "stencil.c", "timing.c"], ["-pthread"], ["output=none"], True),
+    "jacobi_cart": (["jacobi_cart.c"], [], [], False),
+    "jacobi_hybrid": (["jacobi_hybrid.c"], ["-fopenmp"], ["1"], False),     # one thread per rank
+    "jacobi_mg": (["jacobi_mg.c"], [], [], False),
+}
+
+
+def parse_args():
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("--suites", default="mc,jacobi,sort", help="comma separated: mc, jacobi, sort")
+    p.add_argument("--modes", default="strong,weak", help="comma separated: strong, weak")
+    p.add_argument("--ranks", default="1,2,4", help="rank counts to run, e.g. 4,8,16,32")
+    p.add_argument("--launcher", default="mpirun", choices=["mpirun", "srun"])
+    p.add_argument("--nodes", type=int, default=0, help="srun -N (0 = let srun decide)")
+    p.add_argument("--launcher-args", default="", help="extra launcher arguments, e.g. --oversubscribe or --exclusive")
+    p.add_argument("--repeat", type=int, default=1, help="runs per point; the fastest one is kept")
+    p.add_argument("--timeout", type=float, default=3600.0, help="seconds before a run is killed")
+    p.add_argument("--mc-tasks", type=int, default=200, help="BASE_TASKS for the Monte Carlo programs")
+    p.add_argument("--mc-points", type=int, default=100000, help="POINTS_PER_TASK for the Monte Carlo programs")
+    p.add_argument("--jacobi", default=",".join(JACOBI_VARIANTS), help="Jacobi variants to run")
+    p.add_argument("--jacobi-args", default="1e-4 1000", help="epsilon and max iterations for the Jacobi programs")
+    p.add_argument("--mg-args", default="1e-4 50", help="epsilon and max V-cycles for jacobi_mg")
+    p.add_argument("--jacobi-size", default="1000", help="mesh rows[xcols] for jacobi and jacobi_fases (rows per rank in weak mode)")
+    p.add_argument("--sort-sizes", default="20000", help="array sizes for the sort (per rank in weak mode)")
+    p.add_argument("--mpicc", default=os.environ.get("MPICC", "mpicc"))
+    p.add_argument("--cc", default=os.environ.get("CC", "gcc"))
+    p.add_argument("--out", default="bench_results", help="directory for binaries, run files and results")
+    p.add_argument("--compare", help="earlier results.json to compare against")
+    p.add_argument("--tolerance", type=float, default=0.10, help="slowdown ratio reported as a regression")
+    return p.parse_args()
+
+
+def local_includes(paths):
+    """paths plus every #include "..." file they pull in from the tree, recursively."""
+    found, todo = set(), list(paths)
+    while todo:
+        path = os.path.normpath(todo.pop())
+        if path in found or not os.path.exists(path):
+            continue
+        found.add(path)
+        with open(path, errors="replace") as f:
+            for name in re.findall(r'^\s*#\s*include\s+"([^"]+)"', f.read(), re.M):
+                todo += [os.path.join(os.path.dirname(path), name), os.path.join(ROOT, name)]
+    return found
+
+
+def build(compiler, sources, output, flags):
+    cmd = [compiler, "-O2"] + flags + [os.path.join(ROOT, s) for s in sources] + ["-o", output, "-lm"]
+    # the command is kept next to the binary, so a change of -D sizes or flags also rebuilds it
+    stamp = output + ".cmd"
+    previous = open(stamp).read() if os.path.exists(stamp) else None
+    if (not os.path.exists(output) or previous != " ".join(cmd) or
+            any(os.path.getmtime(f) > os.path.getmtime(output) for f in local_includes([os.path.join(ROOT, s) for s in sources]))):
+        subprocess.run(cmd, check=True)
+        with open(stamp, "w") as f:
+            f.write(" ".join(cmd))
+    return output
+
+
+def launch_cmd(args, ranks, argv):
+    extra = shlex.split(args.launcher_args)
+    if args.launcher == "srun":
+        nodes = ["-N", str(args.nodes)] if args.nodes > 0 else []
+        return ["srun"] + nodes + ["-n", str(ranks)] + extra + argv
+    return ["mpirun", "-np", str(ranks)] + extra + argv
+
+
+def serial_cmd(args, argv):
+    # on a cluster the baseline also goes through srun, so it lands on a compute node
+    if args.launcher == "srun":
+        return ["srun", "-N", "1", "-n", "1"] + shlex.split(args.launcher_args) + argv
+    return argv
+
+
+def run(args, cmd, run_dir):
+    """Run cmd args.repeat times; return (status, reported seconds, wall seconds) of the fastest run."""
+    best = ("failed", None, None)
+    for _ in range(args.repeat):
+        start = time.monotonic()
+        try:
+            proc = subprocess.run(cmd, cwd=run_dir, capture_output=True, text=True, timeout=args.timeout)
+        except subprocess.TimeoutExpired:
+            return ("timeout", None, time.monotonic() - start)
+        wall = time.monotonic() - start
+
+        reported = None
+        for pattern in TIME_PATTERNS:
+            matches = re.findall(pattern, proc.stdout)
+            if matches:
+                reported = float(matches[-1])
+        if proc.returncode != 0 or reported is None:
+            sys.stderr.write("%s failed (exit %d):\n%s%s\n" % (" ".join(cmd), proc.returncode, proc.stdout[-2000:], proc.stderr[-2000:]))
+            continue
+        if best[1] is None or reported < best[1]:
+            best = ("ok", reported, wall)
+    return best
+
+
+def record(results, suite, program, mode, ranks, size, outcome, baseline_program, baseline):
+    status, seconds, wall = outcome
+    row = {
+        "suite": suite, "program": program, "mode": mode, "ranks": ranks, "size": size,
+        "status": status, "time_s": seconds, "wall_s": wall,
+        "baseline_program": baseline_program, "baseline_s": baseline,
+        "speedup": None, "efficiency": None,
+    }
+    if status == "ok" and baseline and seconds:
+        if mode == "strong":
+            row["speedup"] = baseline / seconds
+            row["efficiency"] = row["speedup"] / ranks
+        else:
+            row["efficiency"] = baseline / seconds
+            row["speedup"] = ranks * row["efficiency"]     # scaled speedup
+    results.append(row)
+    print("%-7s %-14s %-6s %4d ranks  size %-12s %-7s time %-10s speedup %-6s eff %s" % (
+        suite, program, mode, ranks, size, status,
+        "%.4f" % seconds if seconds is not None else "-",
+        "%.2f" % row["speedup"] if row["speedup"] is not None else "-",
+        "%.2f" % row["efficiency"] if row["efficiency"] is not None else "-"))
+    sys.stdout.flush()
+
+
+def bench_mc(args, ranks_list, modes, bin_dir, run_dir, results):
+    flags = ["-DBASE_TASKS=%d" % args.mc_tasks, "-DPOINTS_PER_TASK=%d" % args.mc_points]
+    par = build(args.mpicc, ["Monte Carlo MPI/mpiMCpi.c", "mchits.c"], os.path.join(bin_dir, "mpiMCpi"), flags)
+    seq = build(args.cc, ["Monte Carlo MPI/MCpi_sequencial.c", "mchits.c"], os.path.join(bin_dir, "MCpi_sequencial"), flags)
+    size = "%dx%d" % (args.mc_tasks, args.mc_points)
+
+    # the sequential run does BASE_TASKS tasks, which is the strong problem and the weak per-rank unit
+    outcome = run(args, serial_cmd(args, [seq]), run_dir)
+    baseline = outcome[1]
+    record(results, "mc", "MCpi_sequencial", "serial", 1, size, outcome, None, None)
+
+    for mode in modes:
+        for ranks in ranks_list:
+            if ranks < 2:
+                continue    # rank 0 is only the master
+            argv = [par] + (["weak"] if mode == "weak" else [])
+            outcome = run(args, launch_cmd(args, ranks, argv), run_dir)
+            record(results, "mc", "mpiMCpi", mode, ranks, size, outcome, "MCpi_sequencial", baseline)
+
+
+def bench_jacobi(args, ranks_list, modes, bin_dir, run_dir, results):
+    for name in [v for v in args.jacobi.split(",") if v]:
+        sources, flags, extra, sized = JACOBI_VARIANTS[name]
+        exe = build(args.mpicc, sources, os.path.join(bin_dir, name), flags)
+        solver_args = shlex.split(args.mg_args if name == "jacobi_mg" else args.jacobi_args)
+        if sized:
+            extra = extra + ["size=" + args.jacobi_size]
+
+        # 1 rank is the baseline of every variant, so always run it first; in weak mode
+        # 1 rank solves the per-rank mesh, which is the same problem as strong on 1 rank
+        baseline = None
+        for mode in modes:
+            if mode == "weak" and not sized:
+                continue
+            for ranks in sorted(set([1] + ranks_list)):
+                if ranks == 1 and baseline is not None:
+                    continue
+                argv = [exe] + solver_args + extra + (["weak"] if mode == "weak" else [])
+                outcome = run(args, launch_cmd(args, ranks, argv), run_dir)
+                if ranks == 1:
+                    baseline = outcome[1]
+                size = " ".join(solver_args + (["size=" + args.jacobi_size] if sized else []))
+                record(results, "jacobi", name, mode, ranks, size, outcome, name + "@1", baseline)
+
+
+def bench_sort(args, ranks_list, modes, bin_dir, run_dir, results):
+    par = build(args.mpicc, ["t3/bubble_balanceado.c", "t3/get_time.c"], os.path.join(bin_dir, "bubble_balanceado"), [])
+    baselines = {}
+
+    def baseline(size):
+        # bbs.c has a compile time array size, so there is one binary per size
+        if size not in baselines:
+            exe = build(args.cc, ["t3/bbs.c", "t3/get_time.c"], os.path.join(bin_dir, "bbs_%d" % size),
+                        ["-DARRAY_SIZE=%d" % size, "-DRANDOM_INPUT"])
+            outcome = run(args, serial_cmd(args, [exe]), run_dir)
+            record(results, "sort", "bbs", "serial", 1, str(size), outcome, None, None)
+            baselines[size] = outcome[1]
+        return baselines[size]
+
+    for base in [int(s) for s in args.sort_sizes.split(",") if s]:
+        base_time = baseline(base)
+        for mode in modes:
+            for ranks in ranks_list:
+                size = base * ranks if mode == "weak" else base
+                outcome = run(args, launch_cmd(args, ranks, [par, str(size)]), run_dir)
+                record(results, "sort", "bubble_balanceado", mode, ranks, str(size), outcome, "bbs", base_time)
+
+
+def git_commit():
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], cwd=ROOT, capture_output=True, text=True).stdout.strip()
+    except OSError:
+        return ""
+
+
+def compare(results, old_file, tolerance):
+    """Print the points that got slower than tolerance allows; return how many there were."""
+    with open(old_file) as f:
+        old = {(r["suite"], r["program"], r["mode"], r["ranks"], r["size"]): r for r in json.load(f)["results"]}
+
+    regressions = 0
+    for r in results:
+        before = old.get((r["suite"], r["program"], r["mode"], r["ranks"], r["size"]))
+        if before is None or not before.get("time_s") or r["time_s"] is None:
+            continue
+        ratio = r["time_s"] / before["time_s"]
+        if ratio > 1.0 + tolerance:
+            regressions += 1
+            print("REGRESSION %s %s %s %d ranks size %s: %.4f s -> %.4f s (x%.2f)" % (
+                r["suite"], r["program"], r["mode"], r["ranks"], r["size"], before["time_s"], r["time_s"], ratio))
+    print("%d regression(s) against %s" % (regressions, old_file))
+    return regressions
+
+
+def main():
+    args = parse_args()
+    suites = [s for s in args.suites.split(",") if s]
+    modes = [m for m in args.modes.split(",") if m]
+    ranks_list = [int(n) for n in args.ranks.split(",") if n]
+
+    bin_dir = os.path.join(args.out, "bin")
+    run_dir = os.path.join(args.out, "run")      # programs write their images here
+    os.makedirs(bin_dir, exist_ok=True)
+    os.makedirs(run_dir, exist_ok=True)
+    bin_dir = os.path.abspath(bin_dir)
+
+    results = []
+    if "mc" in suites:
+        bench_mc(args, ranks_list, modes, bin_dir, run_dir, results)
+    if "jacobi" in suites:
+        bench_jacobi(args, ranks_list, modes, bin_dir, run_dir, results)
+    if "sort" in suites:
+        bench_sort(args, ranks_list, modes, bin_dir, run_dir, results)
+
+    meta = {
+        "date": datetime.datetime.now().isoformat(timespec="seconds"),
+        "host": socket.gethostname(),
+        "commit": git_commit(),
+        "launcher": args.launcher,
+        "launcher_args": args.launcher_args,
+        "nodes": args.nodes,
+        "repeat": args.repeat,
+    }
+    with open(os.path.join(args.out, "results.json"), "w") as f:
+        json.dump({"meta": meta, "results": results}, f, indent=2)
+    with open(os.path.join(args.out, "results.csv"), "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=list(results[0].keys()) if results else ["suite"])
+        writer.writeheader()
+        writer.writerows(results)
+    print("Results written to %s/results.json and results.csv" % args.out)
+
+    if args.compare and compare(results, args.compare, args.tolerance) > 0:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
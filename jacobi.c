@@ -1,31 +1,61 @@
 /* Steven Smiley | COMP233 | Jacobi Iterations
 *  Based on work by Argonne National Laboratory.
 *  https://www.mcs.anl.gov/research/projects/mpi/tutorial/mpiexmpl/src/jacobi/C/main.html
+*
+*  mpicc jacobi.c stencil.c timing.c -o jacobi -lm
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 #include "mpi.h"
+#include "stencil.h"
+#include "timing.h"
+
+#define CKPT_HEADER 64        //bytes reserved at the start of checkpoint and raw files
+#define BALANCE_TOLERANCE 1.05    //stencil time imbalance (max / avg) that balance=N tolerates before moving rows
+
+//state of the asynchronous checkpoint writer
+typedef struct {
+    float*      buffer;     //copy of the chunk being written, so the solver can keep changing xLocal
+    MPI_File    fh;
+    MPI_Request request;
+    int         pending;    //a write is in flight
+    int         file;       //which of the two checkpoint files (0 or 1) was written last
+    int         itrCount;   //iteration and norm stored with the pending write
+    float       norm;
+} Checkpoint;
 
 float lerp(float from, float to, float t);
-void writeToPPM(float* mesh, int iterations, const int MESHSIZE);
-int getChunkRows(int rank, int commSize, const int MESHSIZE);
-int getChunkSize(int rank, int commSize, const int MESHSIZE);
+void writePPM(float* chunk, MPI_Offset meshOffset, long points, int iterations, const int MESHROWS, const int MESHCOLS);
+void writeRaw(float* chunk, MPI_Offset meshOffset, long points, int iterations, const int MESHROWS, const int MESHCOLS);
+int getChunkRows(int rank, int commSize, const int MESHROWS);
+long getChunkSize(int rank, int commSize, const int MESHROWS, const int MESHCOLS);
+void startCheckpoint(Checkpoint* ckpt, float* chunk, MPI_Offset meshOffset, long points, int itrCount, float norm, const int MESHROWS, const int MESHCOLS);
+void finishCheckpoint(Checkpoint* ckpt, const int MESHROWS, const int MESHCOLS);
+float colourSweep(float* x, int rBegin, int rEnd, int firstRow, int colour, float omega, int withNorm, const int MESHCOLS);
+void exchangeColour(float* x, int colour, int firstRow, int chunkRows, MPI_Datatype* colourTypes, int rank, int commSize, const int MESHCOLS);
+int readCheckpoint(float* chunk, MPI_Offset meshOffset, long points, int* itrCount, float* norm, int* file, const int MESHROWS, const int MESHCOLS);
+void accuracyReport(float* chunk, MPI_Offset meshOffset, long points, const char* reference, const int MESHROWS, const int MESHCOLS);
+float* sharedChunk(int chunkRows, int attachedUp, int attachedDown, MPI_Comm nodeComm, MPI_Win* win, const int MESHCOLS);
+void syncShared(MPI_Win* windows, MPI_Comm nodeComm);
+int rebalanceRows(float** xLocal, float** xNew, int* chunkRows, int* firstRow, double stencilTime, int itrCount, const int MESHROWS, const int MESHCOLS);
 
 int main( argc, argv )
 int argc;
 char **argv;
 {
-    const int MESHSIZE = 1000;                //size of the mesh to compute
+    //size and bounds of the mesh; size=, bounds= and weak change them at run time
+    int MESHROWS = 1000;                //rows of the mesh to compute (split between the ranks)
+    int MESHCOLS = 1000;                //columns of the mesh to compute
     
-    const float NORTH_BOUND = 100.0;        //north bounding value for the mesh
-    const float SOUTH_BOUND = 100.0;        //south bounding value for the mesh
-    const float EAST_BOUND = 0.0;          //east bounding value for the mesh
-    const float WEST_BOUND = 0.0;          //west bounding value for the mesh
-    const float INTERIOR_AVG =              //value to initialize interior mesh points with
-        (NORTH_BOUND + SOUTH_BOUND + EAST_BOUND + WEST_BOUND) / 4.0;    //average the 4 bounds
+    float NORTH_BOUND = 100.0;        //north bounding value for the mesh
+    float SOUTH_BOUND = 100.0;        //south bounding value for the mesh
+    float EAST_BOUND = 0.0;          //east bounding value for the mesh
+    float WEST_BOUND = 0.0;          //west bounding value for the mesh
+    float INTERIOR_AVG;              //value to initialize interior mesh points with (average of the 4 bounds)
 
 
     /*
@@ -39,15 +69,69 @@ char **argv;
     status: used for storing the status reported from MPI communications
     diffNorm: used for local differential sum
     gDiffNorm: used for reduction of all the local diffNorms
+    overlap: when set, the halo exchange is non-blocking and overlapped with the interior rows
+    checkEvery: diffNorm is only computed and reduced every checkEvery iterations
+    lagged: when set, diffNorm is reduced with MPI_Iallreduce and tested one iteration later
+    normRequest: pending MPI_Iallreduce in lagged mode (MPI_REQUEST_NULL when none)
+    normItr: iteration that the current gDiffNorm belongs to
+    converged: set once gDiffNorm drops to epsilon
+    ckptEvery: write a checkpoint every ckptEvery iterations (0 = never)
+    ckptSeconds: write a checkpoint when this many seconds passed since the last one (0 = never)
+    restart: resume from the newest complete checkpoint
+    sorOmega: over-relaxation factor of the red-black Gauss-Seidel mode (0 = plain Jacobi)
+    firstRow: global index of the first row of this chunk, it decides the colour of each point
+    colourTypes: every second float of a row, starting at column 0 or 1 (one colour of a row)
+    storage: 0 for float, or STENCIL_BF16 / STENCIL_FP16 to keep the mesh in 16 bits while iterating
+    reference: float32 raw file (output=raw of a float run) to compare the final mesh against
+    phaseTime: seconds this rank spent in each phase (see timing.h); always collected
+    timingFormat: write the phase report as "csv" or "json" at the end (NULL = no report)
+    weak: MESHROWS is the number of rows per rank, so the mesh grows with the rank count
+    shm: keep the chunks of the ranks on one node in MPI-3 shared memory, so ghost rows from
+         a neighbour on the same node are read in place and only node boundaries send messages
+    nodeComm: the ranks that share memory with this one
+    attachedUp/attachedDown: the neighbour above/below is on this node and its rows sit right
+         before/after ours in the shared window, so our ghost row is its boundary row
+    windows: shared windows holding xLocal and xNew (the pointers swap, the windows do not)
+    ghostWidth: rows of ghost zone per side; with k > 1 the halo is exchanged every k iterations
+         and the iterations in between also update the ghost rows that are still valid
+    ghostStep: iterations done since the last deep halo exchange
+    balanceEvery: every balanceEvery iterations, move rows between ranks so each rank's share
+         matches its measured stencil speed (0 = keep the getChunkRows partition)
+    balanceSince: stencil time of this rank when the last rebalance happened
     */
     int        rank, commSize, r, c, itrCount;
     int        rFirst, rLast;
     MPI_Status status;
     float     diffNorm, gDiffNorm;
+    int        overlap = 0;
+    int        checkEvery = 1, lagged = 0;
+    MPI_Request normRequest = MPI_REQUEST_NULL;
+    float      sendNorm[2], recvNorm[2];     //{diffNorm, checkpoint request}, owned by the pending MPI_Iallreduce
+    int        sendItr = 0, normItr = 0, converged = 0;
 
     float*     xLocal;     //stores local chunk of mesh
     float*     xNew;       //stores new local chunk of mesh
-    float*     xFull;      //used to assemble the chunks into a full mesh
+    int        outputPPM = 1, outputRaw = 0;   //which output files to write at the end
+    int        ckptEvery = 0, restart = 0;
+    double     ckptSeconds = 0.0, lastCkptTime;
+    Checkpoint ckpt = { NULL, MPI_FILE_NULL, MPI_REQUEST_NULL, 0, 1, 0, 0.0 };
+    MPI_Offset meshOffset = 0;     //index of the first point of this chunk in the full mesh
+    float      sorOmega = 0.0;
+    int        firstRow;
+    MPI_Datatype colourTypes[2];
+    int        storage = 0;
+    uint16_t*  hLocal = NULL;     //16-bit copies of xLocal and xNew used when storage is set
+    uint16_t*  hNew = NULL;
+    const char* reference = NULL;
+    double     phaseTime[PHASE_COUNT] = { 0.0 }, mark;
+    const char* timingFormat = NULL;
+    int        shm = 0, attachedUp = 0, attachedDown = 0;
+    MPI_Comm   nodeComm = MPI_COMM_NULL;
+    MPI_Win    windows[2];
+    int        ghostWidth = 1, ghostStep = 0;
+    int        balanceEvery = 0;
+    double     balanceSince = 0.0;
+    int        weak = 0;
 
     float epsilon;          //threshold for gDiffNorm; used to stop the Jacobi iteration loop
     int maxIterations;      //threshold for itrCount; used to stop the Jacobi iteration loop
@@ -60,9 +144,8 @@ char **argv;
     MPI_Comm_rank( MPI_COMM_WORLD, &rank );
     MPI_Comm_size( MPI_COMM_WORLD, &commSize );
 
-    //initialize constants dependent on communicator size
-    const int CHUNKROWS = getChunkRows(rank, commSize, MESHSIZE);     //number of rows in a process chunk
-    const int CHUNKSIZE = getChunkSize(rank, commSize, MESHSIZE);     //number of floats in a process chunk
+    int        CHUNKROWS;     //number of rows in a process chunk (balance=N moves it later)
+    long       CHUNKSIZE;     //number of floats in a process chunk
 
     
     //check that we have enough command line arguments
@@ -70,7 +153,9 @@ char **argv;
         //print usage information to head
         if(rank == 0){
             printf("Please specify the correct number of arguments.\n");
-            printf("Usage: jacobi [epsilon] [max_iterations]\n");
+            printf("Usage: jacobi [epsilon] [max_iterations] [overlap] [check=K] [lagged] [output=ppm|raw|all|none]\n");
+            printf("       [ckpt=N] [ckpt_secs=T] [restart] [sor=omega] [storage=fp32|fp16|bf16] [reference=file.raw]\n");
+            printf("       [timing=csv|json] [shm] [ghost=k] [balance=N] [size=rows[xcols]] [bounds=n,s,e,w] [weak]\n");
         }
 
         //exit the program
@@ -78,10 +163,169 @@ char **argv;
         return 0;
     }
 
+    //optional mode arguments follow the required ones
+    for(r = 3; r < argc; r++){
+        if(strcmp(argv[r], "overlap") == 0){
+            overlap = 1;
+        }
+        else if(strncmp(argv[r], "check=", 6) == 0 && strtol(argv[r] + 6, NULL, 10) > 0){
+            checkEvery = strtol(argv[r] + 6, NULL, 10);
+        }
+        else if(strcmp(argv[r], "lagged") == 0){
+            lagged = 1;
+        }
+        else if(strcmp(argv[r], "output=ppm") == 0 || strcmp(argv[r], "output=raw") == 0 ||
+                strcmp(argv[r], "output=all") == 0 || strcmp(argv[r], "output=none") == 0){
+            outputPPM = strcmp(argv[r] + 7, "ppm") == 0 || strcmp(argv[r] + 7, "all") == 0;
+            outputRaw = strcmp(argv[r] + 7, "raw") == 0 || strcmp(argv[r] + 7, "all") == 0;
+        }
+        else if(strncmp(argv[r], "ckpt=", 5) == 0){
+            ckptEvery = strtol(argv[r] + 5, NULL, 10);
+        }
+        else if(strncmp(argv[r], "ckpt_secs=", 10) == 0){
+            ckptSeconds = strtod(argv[r] + 10, NULL);
+        }
+        else if(strcmp(argv[r], "restart") == 0){
+            restart = 1;
+        }
+        else if(strncmp(argv[r], "sor=", 4) == 0 && strtod(argv[r] + 4, NULL) > 0.0 && strtod(argv[r] + 4, NULL) < 2.0){
+            sorOmega = strtod(argv[r] + 4, NULL);
+        }
+        else if(strcmp(argv[r], "storage=fp32") == 0){
+            storage = 0;
+        }
+        else if(strcmp(argv[r], "storage=fp16") == 0){
+            storage = STENCIL_FP16;
+        }
+        else if(strcmp(argv[r], "storage=bf16") == 0){
+            storage = STENCIL_BF16;
+        }
+        else if(strncmp(argv[r], "reference=", 10) == 0){
+            reference = argv[r] + 10;
+        }
+        else if(strcmp(argv[r], "timing=csv") == 0 || strcmp(argv[r], "timing=json") == 0){
+            timingFormat = argv[r] + 7;
+        }
+        else if(strcmp(argv[r], "shm") == 0){
+            shm = 1;
+        }
+        else if(strncmp(argv[r], "ghost=", 6) == 0 && strtol(argv[r] + 6, NULL, 10) > 0){
+            ghostWidth = strtol(argv[r] + 6, NULL, 10);
+        }
+        else if(strncmp(argv[r], "balance=", 8) == 0){
+            balanceEvery = strtol(argv[r] + 8, NULL, 10);
+        }
+        else if(strncmp(argv[r], "size=", 5) == 0 && sscanf(argv[r] + 5, "%d", &MESHROWS) == 1){
+            //a single number keeps the mesh square
+            if(sscanf(argv[r] + 5, "%*dx%d", &MESHCOLS) != 1) MESHCOLS = MESHROWS;
+        }
+        else if(strncmp(argv[r], "bounds=", 7) == 0 &&
+                sscanf(argv[r] + 7, "%f,%f,%f,%f", &NORTH_BOUND, &SOUTH_BOUND, &EAST_BOUND, &WEST_BOUND) == 4){
+        }
+        else if(strcmp(argv[r], "weak") == 0){
+            weak = 1;
+        }
+        else{
+            if(rank == 0) printf("Unknown option: %s\n", argv[r]);
+            MPI_Finalize();
+            return 0;
+        }
+    }
+
+    //in weak mode every rank keeps the same number of rows, like the tasks of mpiMCpi weak
+    if(weak) MESHROWS *= commSize;
+    INTERIOR_AVG = (NORTH_BOUND + SOUTH_BOUND + EAST_BOUND + WEST_BOUND) / 4.0;
+
+    //every rank needs a row, and MPI counts are int: a chunk (as PPM bytes) must stay under 2^31
+    if(MESHROWS < 3 || MESHCOLS < 3 || MESHROWS < commSize ||
+       (long)getChunkRows(0, commSize, MESHROWS) * MESHCOLS * 3 > INT_MAX){
+        if(rank == 0) printf("Cannot split a %d x %d mesh over %d ranks\n", MESHROWS, MESHCOLS, commSize);
+        MPI_Finalize();
+        return 0;
+    }
+
+    //initialize sizes dependent on communicator size
+    CHUNKROWS = getChunkRows(rank, commSize, MESHROWS);
+    CHUNKSIZE = getChunkSize(rank, commSize, MESHROWS, MESHCOLS);
+
+    //the 16-bit mesh runs the plain blocking loop; the other modes work on floats
+    if(storage && (overlap || sorOmega > 0.0 || ckptEvery > 0 || ckptSeconds > 0.0 || restart)){
+        if(rank == 0) printf("storage=fp16/bf16 cannot be combined with overlap, sor, ckpt or restart\n");
+        MPI_Finalize();
+        return 0;
+    }
+
+    //red-black SOR sends each colour right after updating it, so it has no overlapped variant
+    if(sorOmega > 0.0 && overlap){
+        if(rank == 0) printf("sor cannot be combined with overlap\n");
+        MPI_Finalize();
+        return 0;
+    }
+
+    //the shared-memory halo replaces the blocking exchange only
+    if(shm && (storage || overlap || sorOmega > 0.0)){
+        if(rank == 0) printf("shm cannot be combined with overlap, sor or storage=fp16/bf16\n");
+        MPI_Finalize();
+        return 0;
+    }
+
+    //deep ghost zones come from the direct neighbours only, so every chunk must be at least that deep
+    if(ghostWidth > 1 && (storage || overlap || sorOmega > 0.0 || shm)){
+        if(rank == 0) printf("ghost=k cannot be combined with overlap, sor, shm or storage=fp16/bf16\n");
+        MPI_Finalize();
+        return 0;
+    }
+    if(ghostWidth > MESHROWS / commSize){
+        if(rank == 0) printf("ghost=%d is deeper than the smallest chunk (%d rows)\n", ghostWidth, MESHROWS / commSize);
+        MPI_Finalize();
+        return 0;
+    }
+
+    //rebalancing reallocates xLocal and xNew, which the shared windows, deep ghost zones and 16-bit copies cannot follow
+    if(balanceEvery > 0 && (storage || shm || ghostWidth > 1)){
+        if(rank == 0) printf("balance=N cannot be combined with shm, ghost=k or storage=fp16/bf16\n");
+        MPI_Finalize();
+        return 0;
+    }
+
     //allocate memory to 2d arrays
-    xLocal = (float*)malloc((CHUNKROWS + 2) * MESHSIZE * sizeof(float));
-    xNew = (float*)malloc((CHUNKROWS + 2) * MESHSIZE * sizeof(float));
-    if(rank == 0) xFull = (float*)malloc(MESHSIZE * MESHSIZE * sizeof(float));  //only the master needs to use this
+    if(shm){
+        /* Ranks are ordered by world rank inside nodeComm, so the node-local neighbour
+           is the world neighbour whenever the node holds a contiguous block of ranks */
+        int nodeRank, nodeSize, attachedCount;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+        MPI_Comm_rank(nodeComm, &nodeRank);
+        MPI_Comm_size(nodeComm, &nodeSize);
+
+        int* nodeRanks = (int*)malloc(nodeSize * sizeof(int));
+        MPI_Allgather(&rank, 1, MPI_INT, nodeRanks, 1, MPI_INT, nodeComm);
+        attachedUp = nodeRank > 0 && nodeRanks[nodeRank - 1] == rank - 1;
+        attachedDown = nodeRank < nodeSize - 1 && nodeRanks[nodeRank + 1] == rank + 1;
+        free(nodeRanks);
+
+        xLocal = sharedChunk(CHUNKROWS, attachedUp, attachedDown, nodeComm, &windows[0], MESHCOLS);
+        xNew = sharedChunk(CHUNKROWS, attachedUp, attachedDown, nodeComm, &windows[1], MESHCOLS);
+
+        MPI_Reduce(&attachedDown, &attachedCount, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+        if(rank == 0) printf("Shared-memory halo: %d of %d rank boundaries inside a node\n", attachedCount, commSize - 1);
+    }
+    else{
+        //with deep ghost zones rows 1 - ghostWidth .. CHUNKROWS + ghostWidth exist; row 0 stays the nearest ghost row
+        xLocal = (float*)malloc((size_t)(CHUNKROWS + 2 * ghostWidth) * MESHCOLS * sizeof(float)) + (ghostWidth - 1) * MESHCOLS;
+        xNew = (float*)malloc((size_t)(CHUNKROWS + 2 * ghostWidth) * MESHCOLS * sizeof(float)) + (ghostWidth - 1) * MESHCOLS;
+    }
+    if(ckptEvery > 0 || ckptSeconds > 0.0) ckpt.buffer = (float*)malloc(CHUNKSIZE * sizeof(float));
+
+    for(r = 0; r < rank; r++){
+        meshOffset += getChunkSize(r, commSize, MESHROWS, MESHCOLS);
+    }
+    firstRow = meshOffset / MESHCOLS;
+
+    //a colour takes every second point of a row; which column it starts on depends on the row
+    MPI_Type_vector(MESHCOLS / 2, 1, 2, MPI_FLOAT, &colourTypes[0]);
+    MPI_Type_commit(&colourTypes[0]);
+    MPI_Type_vector((MESHCOLS - 1) / 2, 1, 2, MPI_FLOAT, &colourTypes[1]);
+    MPI_Type_commit(&colourTypes[1]);
 
     //assign our epsilon and maxIteration variables using our command line arguments
     epsilon = strtod(argv[1], NULL);
@@ -90,6 +334,23 @@ char **argv;
     //print the standard header
     printf("Steven Smiley | COMP233 | Jacobi Iterations (MPI)\n");
 
+    //pick the stencil kernel for this CPU
+    const char* isa = stencilInit();
+    if(rank == 0) printf("Stencil kernel: %s\n", isa);
+    if(rank == 0) printf("Mesh: %d x %d%s, bounds N %g S %g E %g W %g\n", MESHROWS, MESHCOLS, weak ? " (weak)" : "",
+                         NORTH_BOUND, SOUTH_BOUND, EAST_BOUND, WEST_BOUND);
+    if(rank == 0 && sorOmega > 0.0) printf("Red-black SOR, omega = %f\n", sorOmega);
+    if(rank == 0 && ghostWidth > 1) printf("Deep ghost zones: %d rows, halo exchanged every %d iterations\n", ghostWidth, ghostWidth);
+    if(rank == 0 && storage){
+        //distance between 100.0 and the next value the format can hold
+        float hundred = 100.0, step[2];
+        uint16_t h[2];
+        stencilPack(&hundred, h, 1, storage);
+        h[1] = h[0] + 1;
+        stencilUnpack(h, step, 2, storage);
+        printf("Mesh storage: %s (resolution near 100 is %g)\n", storage == STENCIL_BF16 ? "bf16" : "fp16", step[1] - step[0]);
+    }
+
     /* Note that top and bottom processes have one less row of interior
        points */
     rFirst = 1;
@@ -99,107 +360,319 @@ char **argv;
 
     /* Fill the data as specified */
     for (r = 1; r <= CHUNKROWS; r++) {
-        for(c = 0; c < MESHSIZE; c++){
-            xLocal[r * MESHSIZE + c] = INTERIOR_AVG;    //set value for interior points
+        for(c = 0; c < MESHCOLS; c++){
+            xLocal[r * MESHCOLS + c] = INTERIOR_AVG;    //set value for interior points
         }
 
-        xLocal[r * MESHSIZE + MESHSIZE-1] = EAST_BOUND; //set value for east boundary
-        xLocal[r * MESHSIZE + 0] = WEST_BOUND;          //set value for west boundary
+        xLocal[r * MESHCOLS + MESHCOLS-1] = EAST_BOUND; //set value for east boundary
+        xLocal[r * MESHCOLS + 0] = WEST_BOUND;          //set value for west boundary
+    }
+    //(on inner ranks these are ghost rows; in shm mode an attached one is the neighbour's row)
+    for (c=0; c<MESHCOLS; c++) {
+	    if (!attachedUp) xLocal[(rFirst-1) * MESHCOLS + c] = NORTH_BOUND;   //set value for north boundary
+	    if (!attachedDown) xLocal[(rLast+1) * MESHCOLS + c] = SOUTH_BOUND;  //set value for south boundary
     }
-    for (c=0; c<MESHSIZE; c++) {
-	    xLocal[(rFirst-1) * MESHSIZE + c] = NORTH_BOUND;   //set value for north boundary
-	    xLocal[(rLast+1) * MESHSIZE + c] = SOUTH_BOUND;    //set value for south boundary
+
+    //checkpoints store the global mesh, so they can be read back with any number of ranks
+    itrCount = 0;   //initialize iteration count
+    gDiffNorm = 0.0;
+    if(restart){
+        if(readCheckpoint(xLocal + (1 * MESHCOLS), meshOffset, CHUNKSIZE, &itrCount, &gDiffNorm, &ckpt.file, MESHROWS, MESHCOLS)){
+            if(rank == 0) printf("Restarting from jacobi_ckpt.%d at iteration %d (diff %e)\n", ckpt.file, itrCount, gDiffNorm);
+        }
+        else if(rank == 0){
+            printf("No complete checkpoint found, starting from scratch\n");
+        }
     }
     
-    for (r=0; r<CHUNKROWS+2; r++) 
-	    for (c=0; c<MESHSIZE; c++) {
-         xNew[r * MESHSIZE + c] = xLocal[r * MESHSIZE + c];
+    //in shm mode an attached ghost row belongs to the neighbour, which fills it itself
+    for (r = attachedUp ? 1 : 0; r < CHUNKROWS + (attachedDown ? 1 : 2); r++)
+	    for (c=0; c<MESHCOLS; c++) {
+         xNew[r * MESHCOLS + c] = xLocal[r * MESHCOLS + c];
          }
+
+    //round the starting mesh to the storage format; xLocal gets the final mesh back after the loop
+    if(storage){
+        hLocal = (uint16_t*)malloc((size_t)(CHUNKROWS + 2) * MESHCOLS * sizeof(uint16_t));
+        hNew = (uint16_t*)malloc((size_t)(CHUNKROWS + 2) * MESHCOLS * sizeof(uint16_t));
+        stencilPack(xLocal, hLocal, (CHUNKROWS + 2) * MESHCOLS, storage);
+        memcpy(hNew, hLocal, (CHUNKROWS + 2) * MESHCOLS * sizeof(uint16_t));
+    }
          
          	
     if(rank == 0)   //start the timer on the master
         start = MPI_Wtime();
 
+    lastCkptTime = MPI_Wtime();
+    mark = MPI_Wtime();
+
     //Jacobi iteration computation loop
-    itrCount = 0;   //initialize iteration count
+    //each phase is closed with phaseMark, which adds the time since the previous mark to it
     do {
+    itrCount ++;
+    int checkNow = (itrCount % checkEvery == 0);   //does this iteration contribute a diffNorm?
+    if(sorOmega > 0.0){
+        /* Red-black Gauss-Seidel, updated in place. A red point only reads black
+           neighbours and vice versa, so each colour needs just the other colour of
+           the ghost rows, sent right after it was updated */
+        exchangeColour(xLocal, 1, firstRow, CHUNKROWS, colourTypes, rank, commSize, MESHCOLS);
+        mark = phaseMark(phaseTime, PHASE_HALO, mark);
+        diffNorm = colourSweep(xLocal, rFirst, rLast, firstRow, 0, sorOmega, checkNow, MESHCOLS);
+        mark = phaseMark(phaseTime, PHASE_STENCIL, mark);
+        exchangeColour(xLocal, 0, firstRow, CHUNKROWS, colourTypes, rank, commSize, MESHCOLS);
+        mark = phaseMark(phaseTime, PHASE_HALO, mark);
+        diffNorm += colourSweep(xLocal, rFirst, rLast, firstRow, 1, sorOmega, checkNow, MESHCOLS);
+        mark = phaseMark(phaseTime, PHASE_STENCIL, mark);
+    }
+    else if(storage){
+        /* Same exchange as the plain loop, on 16-bit rows: half the bytes per message */
+        if (rank < commSize - 1)
+            MPI_Send( hLocal + (CHUNKROWS * MESHCOLS), MESHCOLS, MPI_UINT16_T, rank + 1, 0,
+                  MPI_COMM_WORLD );
+        if (rank > 0)
+            MPI_Recv( hLocal, MESHCOLS, MPI_UINT16_T, rank - 1, 0,
+                  MPI_COMM_WORLD, &status );
+        if (rank > 0)
+            MPI_Send( hLocal + (1 * MESHCOLS), MESHCOLS, MPI_UINT16_T, rank - 1, 1,
+                  MPI_COMM_WORLD );
+        if (rank < commSize - 1)
+            MPI_Recv( hLocal + ((CHUNKROWS+1) * MESHCOLS), MESHCOLS, MPI_UINT16_T, rank + 1, 1,
+                  MPI_COMM_WORLD, &status );
+        mark = phaseMark(phaseTime, PHASE_HALO, mark);
+
+        diffNorm = stencilRows16(hLocal, hNew, rFirst, rLast, checkNow, MESHCOLS, storage);
+        mark = phaseMark(phaseTime, PHASE_STENCIL, mark);
+    }
+    else if(overlap){
+        /* Post the halo receives and sends, then compute the rows that do not
+           depend on the ghost rows while the messages are in flight */
+        MPI_Request requests[4];
+        int requestCount = 0;
+
+        if (rank > 0)
+            MPI_Irecv( xLocal, MESHCOLS, MPI_FLOAT, rank - 1, 0,
+                   MPI_COMM_WORLD, &requests[requestCount++] );
+        if (rank < commSize - 1)
+            MPI_Irecv( xLocal + ((CHUNKROWS+1) * MESHCOLS), MESHCOLS, MPI_FLOAT, rank + 1, 1,
+                   MPI_COMM_WORLD, &requests[requestCount++] );
+        if (rank < commSize - 1)
+            MPI_Isend( xLocal + (CHUNKROWS * MESHCOLS), MESHCOLS, MPI_FLOAT, rank + 1, 0,
+                   MPI_COMM_WORLD, &requests[requestCount++] );
+        if (rank > 0)
+            MPI_Isend( xLocal + (1 * MESHCOLS), MESHCOLS, MPI_FLOAT, rank - 1, 1,
+                   MPI_COMM_WORLD, &requests[requestCount++] );
+        mark = phaseMark(phaseTime, PHASE_HALO, mark);
+
+        diffNorm = stencilRows(xLocal, xNew, rFirst + 1, rLast - 1, checkNow, MESHCOLS);
+        mark = phaseMark(phaseTime, PHASE_STENCIL, mark);
+
+        //only the part of the exchange that did not hide behind the interior rows counts as halo time
+        MPI_Waitall( requestCount, requests, MPI_STATUSES_IGNORE );
+        mark = phaseMark(phaseTime, PHASE_HALO, mark);
+
+        //finish the two boundary rows now that the ghost rows have arrived
+        if (rLast >= rFirst)
+            diffNorm += stencilRows(xLocal, xNew, rFirst, rFirst, checkNow, MESHCOLS);
+        if (rLast > rFirst)
+            diffNorm += stencilRows(xLocal, xNew, rLast, rLast, checkNow, MESHCOLS);
+        mark = phaseMark(phaseTime, PHASE_STENCIL, mark);
+    }
+    else if(ghostWidth > 1){
+        /* Communication-avoiding Jacobi: every ghostWidth iterations exchange ghostWidth rows
+           per side, then iterate locally. Each iteration spoils the outermost valid ghost row,
+           so the rows updated beyond our own shrink by one per iteration. Ghost rows past the
+           global boundary rows are never updated */
+        int depth = ghostWidth - 1 - ghostStep;     //ghost rows per side to update on this iteration
+
+        if(ghostStep == 0){
+            int up = (rank > 0) ? rank - 1 : MPI_PROC_NULL;
+            int down = (rank < commSize - 1) ? rank + 1 : MPI_PROC_NULL;
+            MPI_Sendrecv( xLocal + ((CHUNKROWS - ghostWidth + 1) * MESHCOLS), ghostWidth * MESHCOLS, MPI_FLOAT, down, 0,
+                      xLocal + ((1 - ghostWidth) * MESHCOLS), ghostWidth * MESHCOLS, MPI_FLOAT, up, 0,
+                      MPI_COMM_WORLD, &status );
+            MPI_Sendrecv( xLocal + (1 * MESHCOLS), ghostWidth * MESHCOLS, MPI_FLOAT, up, 1,
+                      xLocal + ((CHUNKROWS + 1) * MESHCOLS), ghostWidth * MESHCOLS, MPI_FLOAT, down, 1,
+                      MPI_COMM_WORLD, &status );
+
+            //xNew needs the rows that are not updated below too: boundary columns and global boundary rows
+            if (rank > 0)
+                memcpy( xNew + ((1 - ghostWidth) * MESHCOLS), xLocal + ((1 - ghostWidth) * MESHCOLS), ghostWidth * MESHCOLS * sizeof(float) );
+            if (rank < commSize - 1)
+                memcpy( xNew + ((CHUNKROWS + 1) * MESHCOLS), xLocal + ((CHUNKROWS + 1) * MESHCOLS), ghostWidth * MESHCOLS * sizeof(float) );
+        }
+        mark = phaseMark(phaseTime, PHASE_HALO, mark);
+
+        //local row r is global row firstRow + r - 1; only global rows 1 .. MESHROWS-2 are updated
+        int gFirst = rFirst - depth, gLast = rLast + depth;
+        if (gFirst < 2 - firstRow) gFirst = 2 - firstRow;
+        if (gLast > MESHROWS - 1 - firstRow) gLast = MESHROWS - 1 - firstRow;
+
+        //only our own rows count towards diffNorm; the redundant ghost rows belong to the neighbours
+        if (gFirst < rFirst) stencilRows(xLocal, xNew, gFirst, rFirst - 1, 0, MESHCOLS);
+        diffNorm = stencilRows(xLocal, xNew, rFirst, rLast, checkNow, MESHCOLS);
+        if (gLast > rLast) stencilRows(xLocal, xNew, rLast + 1, gLast, 0, MESHCOLS);
+        mark = phaseMark(phaseTime, PHASE_STENCIL, mark);
+
+        ghostStep = (ghostStep + 1) % ghostWidth;
+    }
+    else if(shm){
+        /* Wait until the node neighbours finished the last sweep: their new rows are then
+           visible in xLocal, and they no longer read the rows we are about to overwrite in
+           xNew. Only the ghost rows across a node boundary still travel as messages */
+        syncShared(windows, nodeComm);
+
+        int up = (rank > 0 && !attachedUp) ? rank - 1 : MPI_PROC_NULL;
+        int down = (rank < commSize - 1 && !attachedDown) ? rank + 1 : MPI_PROC_NULL;
+        MPI_Sendrecv( xLocal + (CHUNKROWS * MESHCOLS), MESHCOLS, MPI_FLOAT, down, 0,
+                  xLocal, MESHCOLS, MPI_FLOAT, up, 0, MPI_COMM_WORLD, &status );
+        MPI_Sendrecv( xLocal + (1 * MESHCOLS), MESHCOLS, MPI_FLOAT, up, 1,
+                  xLocal + ((CHUNKROWS+1) * MESHCOLS), MESHCOLS, MPI_FLOAT, down, 1, MPI_COMM_WORLD, &status );
+        mark = phaseMark(phaseTime, PHASE_HALO, mark);
+
+        diffNorm = stencilRows(xLocal, xNew, rFirst, rLast, checkNow, MESHCOLS);
+        mark = phaseMark(phaseTime, PHASE_STENCIL, mark);
+    }
+    else{
 	/* Send up unless I'm at the top, then receive from below */
 	/* Note the use of xlocal[i] for &xlocal[i][0] */
 	if (rank < commSize - 1) 
-	    MPI_Send( xLocal + (CHUNKROWS * MESHSIZE), MESHSIZE, MPI_FLOAT, rank + 1, 0, 
+	    MPI_Send( xLocal + (CHUNKROWS * MESHCOLS), MESHCOLS, MPI_FLOAT, rank + 1, 0, 
 		      MPI_COMM_WORLD );
 	if (rank > 0)
-	    MPI_Recv( xLocal, MESHSIZE, MPI_FLOAT, rank - 1, 0, 
+	    MPI_Recv( xLocal, MESHCOLS, MPI_FLOAT, rank - 1, 0, 
 		      MPI_COMM_WORLD, &status );
 
 	/* Send down unless I'm at the bottom */
 	if (rank > 0) 
-	    MPI_Send( xLocal + (1 * MESHSIZE), MESHSIZE, MPI_FLOAT, rank - 1, 1, 
+	    MPI_Send( xLocal + (1 * MESHCOLS), MESHCOLS, MPI_FLOAT, rank - 1, 1, 
 		      MPI_COMM_WORLD );
 	if (rank < commSize - 1) 
-	    MPI_Recv( xLocal + ((CHUNKROWS+1) * MESHSIZE), MESHSIZE, MPI_FLOAT, rank + 1, 1, 
+	    MPI_Recv( xLocal + ((CHUNKROWS+1) * MESHCOLS), MESHCOLS, MPI_FLOAT, rank + 1, 1, 
 		      MPI_COMM_WORLD, &status );
+	mark = phaseMark(phaseTime, PHASE_HALO, mark);
 
 
 	/* Compute new values (but not on boundary) */
-	itrCount ++;
-	diffNorm = 0.0;
-	for (r=rFirst; r<=rLast; r++) 
-	    for (c=1; c<MESHSIZE-1; c++) {
-		xNew[r * MESHSIZE + c] = (xLocal[r * MESHSIZE + c+1] + xLocal[r * MESHSIZE + c-1] +     //new value computed as the average of its 4 neighbors
-			      xLocal[(r+1) * MESHSIZE + c] + xLocal[(r-1) * MESHSIZE + c]) / 4.0;
-		diffNorm += (xNew[r * MESHSIZE + c] - xLocal[r * MESHSIZE + c]) *           //compute diffNorm sum
-		            (xNew[r * MESHSIZE + c] - xLocal[r * MESHSIZE + c]);
-	    }
-
-    //swap new to local using pointers
-    float* tmp = xLocal;
-    xLocal = xNew;
-    xNew = tmp;
+	diffNorm = stencilRows(xLocal, xNew, rFirst, rLast, checkNow, MESHCOLS);
+	mark = phaseMark(phaseTime, PHASE_STENCIL, mark);
+    }
+
+    //swap new to local using pointers (the SOR mode works in place)
+    if(storage){
+        uint16_t* tmp = hLocal;
+        hLocal = hNew;
+        hNew = tmp;
+    }
+    else if(sorOmega == 0.0){
+        float* tmp = xLocal;
+        xLocal = xNew;
+        xNew = tmp;
+    }
 
     //reduce value for diffNorm
-	MPI_Allreduce( &diffNorm, &gDiffNorm, 1, MPI_FLOAT, MPI_SUM,
+    //a time based checkpoint request rides along with diffNorm, so every rank agrees on when to write
+    int haveNorm = 0, ckptNow = 0;
+    sendNorm[0] = diffNorm;
+    sendNorm[1] = (ckptSeconds > 0.0 && MPI_Wtime() - lastCkptTime >= ckptSeconds);
+    if(lagged){
+        //finish the reduction posted on an earlier iteration; it overlapped with this iteration's stencil
+        if(normRequest != MPI_REQUEST_NULL){
+            MPI_Wait( &normRequest, MPI_STATUS_IGNORE );
+            gDiffNorm = sqrt( recvNorm[0] );
+            ckptNow = recvNorm[1] > 0.0;
+            normItr = sendItr;
+            haveNorm = 1;
+        }
+        if(checkNow && !(haveNorm && gDiffNorm <= epsilon)){
+            if(ckptNow) sendNorm[1] = 0.0;     //the request that just arrived is served on this iteration
+            sendItr = itrCount;
+            MPI_Iallreduce( sendNorm, recvNorm, 2, MPI_FLOAT, MPI_SUM,
+                    MPI_COMM_WORLD, &normRequest );
+        }
+    }
+    else if(checkNow){
+	MPI_Allreduce( sendNorm, recvNorm, 2, MPI_FLOAT, MPI_SUM,
 		       MPI_COMM_WORLD );
-	gDiffNorm = sqrt( gDiffNorm );  //finish computation on the sum
-	if (rank == 0 && itrCount % 1000 == 0) printf( "At iteration %d, diff is %e\n", itrCount, 
-			       gDiffNorm );
-    } while (gDiffNorm > epsilon && itrCount < maxIterations);  //keep doing Jacobi iterations until we hit our iteration or precision limit
-
-    
-    //assemble mesh into full mesh and write to ppm
-    if(rank == 0){//master
-        //copy the masters chunk into the full mesh
-        memcpy(xFull, xLocal + (1 * MESHSIZE), CHUNKSIZE * sizeof(float));
-
-        int proc;
-        int pointerOffset = 0;
-        for(proc = 1; proc < commSize; proc++){
-            //adjust the pointer offset based on how many elements the previous process put in the array
-            pointerOffset += getChunkSize(proc - 1, commSize, MESHSIZE);
-
-            //recieve each array chunk from other processes and assemble into full mesh
-            //getChunkSize is used here instead of local CHUNKSIZE, because the chunk size can vary by process
-            MPI_Recv(xFull + pointerOffset, getChunkSize(proc, commSize, MESHSIZE), MPI_FLOAT, proc, 0, MPI_COMM_WORLD, &status); 
+	gDiffNorm = sqrt( recvNorm[0] );  //finish computation on the sum
+        ckptNow = recvNorm[1] > 0.0;
+        normItr = itrCount;
+        haveNorm = 1;
+    }
+    mark = phaseMark(phaseTime, PHASE_REDUCE, mark);
+    if((ckptEvery > 0 && itrCount % ckptEvery == 0) || ckptNow){
+        startCheckpoint(&ckpt, xLocal + (1 * MESHCOLS), meshOffset, CHUNKSIZE, itrCount, gDiffNorm, MESHROWS, MESHCOLS);
+        lastCkptTime = MPI_Wtime();
+        mark = phaseMark(phaseTime, PHASE_CHECKPOINT, mark);
+    }
+    if(balanceEvery > 0 && itrCount % balanceEvery == 0 && itrCount < maxIterations){
+        //the checkpoint buffer is resized below, so the write in flight must finish first
+        finishCheckpoint(&ckpt, MESHROWS, MESHCOLS);
+        if(rebalanceRows(&xLocal, &xNew, &CHUNKROWS, &firstRow, phaseTime[PHASE_STENCIL] - balanceSince, itrCount, MESHROWS, MESHCOLS)){
+            CHUNKSIZE = (long)CHUNKROWS * MESHCOLS;
+            meshOffset = (MPI_Offset)firstRow * MESHCOLS;
+            rLast = (rank == commSize - 1) ? CHUNKROWS - 1 : CHUNKROWS;
+            if(ckpt.buffer) ckpt.buffer = (float*)realloc(ckpt.buffer, CHUNKSIZE * sizeof(float));
         }
+        balanceSince = phaseTime[PHASE_STENCIL];
+        mark = phaseMark(phaseTime, PHASE_BALANCE, mark);
+    }
+    if (haveNorm) {
+        converged = !(gDiffNorm > epsilon);
+        if (rank == 0 && normItr % 1000 == 0) printf( "At iteration %d, diff is %e\n", normItr, 
+                   gDiffNorm );
+    }
+    } while (!converged && itrCount < maxIterations);  //keep doing Jacobi iterations until we hit our iteration or precision limit
+
+    //a reduction may still be in flight when the iteration limit stops the loop
+    if (normRequest != MPI_REQUEST_NULL) MPI_Wait( &normRequest, MPI_STATUS_IGNORE );
+    mark = phaseMark(phaseTime, PHASE_REDUCE, mark);
+    finishCheckpoint(&ckpt, MESHROWS, MESHCOLS);
+    mark = phaseMark(phaseTime, PHASE_CHECKPOINT, mark);
 
+    
+    if(rank == 0){
         //stop the timer, because the calculation is complete
         stop = MPI_Wtime();
 
         printf("%d Jacobi iterations took %f seconds.\n", itrCount, stop - start);
-
-        //write the full mesh to ppm output file
-        writeToPPM(xFull, itrCount, MESHSIZE);
     }
-    else{//slaves
-            //send chunks to master
-            MPI_Send(xLocal + (1 * MESHSIZE), CHUNKSIZE, MPI_FLOAT, 0, 0, MPI_COMM_WORLD);
+
+    //widen the 16-bit mesh back to float for the report and the output files
+    if(storage) stencilUnpack(hLocal + (1 * MESHCOLS), xLocal + (1 * MESHCOLS), CHUNKSIZE, storage);
+    if(reference) accuracyReport(xLocal + (1 * MESHCOLS), meshOffset, CHUNKSIZE, reference, MESHROWS, MESHCOLS);
+
+    //every rank writes its own chunk straight into the output files, no gather on the master
+    if(outputPPM || outputRaw){
+        start = MPI_Wtime();
+        if(outputPPM) writePPM(xLocal + (1 * MESHCOLS), meshOffset, CHUNKSIZE, itrCount, MESHROWS, MESHCOLS);
+        if(outputRaw) writeRaw(xLocal + (1 * MESHCOLS), meshOffset, CHUNKSIZE, itrCount, MESHROWS, MESHCOLS);
+        stop = MPI_Wtime();
+        phaseTime[PHASE_OUTPUT] += stop - start;
+
+        if(rank == 0) printf("Output written in %f seconds.\n", stop - start);
     }
-    
+
+    if(timingFormat) timingReport(phaseTime, itrCount, timingFormat,
+                                  strcmp(timingFormat, "json") == 0 ? "jacobi_timing.json" : "jacobi_timing.csv");
+
+    MPI_Type_free(&colourTypes[0]);
+    MPI_Type_free(&colourTypes[1]);
 
     //free our dynamic memory
-    free(xLocal);
-    free(xNew);
-    if(rank == 0) free(xFull);  //only free from master because we only initialized on master
+    if(shm){
+        MPI_Win_unlock_all(windows[0]);
+        MPI_Win_unlock_all(windows[1]);
+        MPI_Win_free(&windows[0]);
+        MPI_Win_free(&windows[1]);
+        MPI_Comm_free(&nodeComm);
+    }
+    else{
+        free(xLocal - (ghostWidth - 1) * MESHCOLS);
+        free(xNew - (ghostWidth - 1) * MESHCOLS);
+    }
+    free(ckpt.buffer);
+    free(hLocal);
+    free(hNew);
 
     //display normal termination message and exit
     if(rank == 0) printf("<normal termination>\n");
@@ -208,37 +681,391 @@ char **argv;
     return 0;
 }
 
-//Write our PPM image from a 2d array
-void writeToPPM(float* mesh, int iterations, const int MESHSIZE) {
-	//make a file for our ppm data
-	FILE* fp = fopen("jacobi.ppm", "w");
+//Write our PPM image as binary P6 with collective MPI-IO
+//every rank converts its own points and writes them at their place in the file
+void writePPM(float* chunk, MPI_Offset meshOffset, long points, int iterations, const int MESHROWS, const int MESHCOLS) {
+    MPI_File fh;
+    char header[128];
+    int rank;
+    long i;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-	//write the data out to the file
-	//output header information to ppm file
-    fprintf(fp, "P3 %d %d 255\n", MESHSIZE, MESHSIZE);
-    fprintf(fp, "#Steven Smiley | COMP233 | OpenMP Mandelbrot\n");
-    fprintf(fp, "#This image took %d iterations to converge.\n", iterations);
+    //every rank builds the same header, so they all know where the pixels start
+    int headerLen = snprintf(header, sizeof(header),
+        "P6\n#This image took %d iterations to converge.\n%d %d\n255\n", iterations, MESHCOLS, MESHROWS);
+
+    unsigned char* pixels = (unsigned char*)malloc(points * 3);
+    for (i = 0; i < points; i++) {
+        pixels[3 * i + 0] = lerp(0.0, 255.0, chunk[i]);    //red
+        pixels[3 * i + 1] = 0;                             //green
+        pixels[3 * i + 2] = lerp(255.0, 0.0, chunk[i]);    //blue
+    }
+
+    MPI_File_open(MPI_COMM_WORLD, "jacobi.ppm", MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_File_set_size(fh, 0);   //drop whatever an older, bigger run left behind
+    if (rank == 0) MPI_File_write_at(fh, 0, header, headerLen, MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(fh, headerLen + meshOffset * 3, pixels, points * 3, MPI_UNSIGNED_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    free(pixels);
+}
 
+//Write the mesh as raw float32 values (native byte order) with collective MPI-IO
+//The file starts with a 64 byte text header "JACOBI float32 <rows> <cols> <iterations>"
+//padded with spaces and ending in a newline, e.g. for numpy:
+//    np.fromfile("jacobi.raw", dtype=np.float32, offset=64).reshape(rows, cols)
+void writeRaw(float* chunk, MPI_Offset meshOffset, long points, int iterations, const int MESHROWS, const int MESHCOLS) {
+    MPI_File fh;
+    char header[64];
+    int rank;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    memset(header, ' ', sizeof(header));
+    memcpy(header, "JACOBI float32", 14);
+    header[snprintf(header + 14, sizeof(header) - 15, " %d %d %d", MESHROWS, MESHCOLS, iterations) + 14] = ' ';
+    header[sizeof(header) - 1] = '\n';
+
+    MPI_File_open(MPI_COMM_WORLD, "jacobi.raw", MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_File_set_size(fh, 0);
+    if (rank == 0) MPI_File_write_at(fh, 0, header, sizeof(header), MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(fh, sizeof(header) + meshOffset * sizeof(float), chunk, points, MPI_FLOAT, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+}
+
+//Over-relaxed Gauss-Seidel update of the points of one colour in rows rBegin..rEnd.
+//A point at global row g and column c is red (colour 0) when g + c is even, black otherwise.
+//Returns the sum of the squared changes, like the Jacobi stencil.
+float colourSweep(float* x, int rBegin, int rEnd, int firstRow, int colour, float omega, int withNorm, const int MESHCOLS) {
+    float diffNorm = 0.0;
     int r, c;
-	for (r = 0; r < MESHSIZE; r++) {
-		for (c = 0; c < MESHSIZE; c++) {
-            float temp = mesh[r * MESHSIZE + c];
-
-            int red = lerp(0.0, 255.0, temp);
-            int blue = lerp(255.0, 0.0, temp);
-
-			//write our color values to the buffer
-			fprintf(fp, "%d 0 %d ", red, blue);
-			if (c % 5 == 4) {
-				//write a newline every 5th rgb value
-				fprintf(fp, "\n");
-			}
-			
-		}
-    }
-	
-	//close the output file
-	fclose(fp);
+
+    for (r = rBegin; r <= rEnd; r++) {
+        //local row r is global row firstRow + r - 1; start on the first interior column of our colour
+        int cFirst = (colour + firstRow + r - 1) % 2;
+        if (cFirst == 0) cFirst = 2;
+
+        for (c = cFirst; c < MESHCOLS - 1; c += 2) {
+            float gs = (x[r * MESHCOLS + c+1] + x[r * MESHCOLS + c-1] +
+                        x[(r+1) * MESHCOLS + c] + x[(r-1) * MESHCOLS + c]) * 0.25f;
+            float change = omega * (gs - x[r * MESHCOLS + c]);
+
+            x[r * MESHCOLS + c] += change;
+            if (withNorm) diffNorm += change * change;
+        }
+    }
+
+    return diffNorm;
+}
+
+//Send the points of one colour in our first and last rows to the neighbours' ghost rows.
+//Only half of each row travels; both sides agree on the start column from the global row.
+void exchangeColour(float* x, int colour, int firstRow, int chunkRows, MPI_Datatype* colourTypes, int rank, int commSize, const int MESHCOLS) {
+    int up = (rank > 0) ? rank - 1 : MPI_PROC_NULL;
+    int down = (rank < commSize - 1) ? rank + 1 : MPI_PROC_NULL;
+    int lastCol = (colour + firstRow + chunkRows - 1) % 2;     //start column in our last row (global firstRow + chunkRows - 1)
+    int firstCol = (colour + firstRow) % 2;                    //start column in our first row
+    int aboveCol = (colour + firstRow - 1) % 2;                //start column in the ghost row above (global firstRow - 1)
+    int belowCol = (colour + firstRow + chunkRows) % 2;        //start column in the ghost row below
+
+    if (firstRow == 0) aboveCol = 0;    //no ghost row above the master; avoid a negative remainder
+
+    MPI_Sendrecv(x + chunkRows * MESHCOLS + lastCol, 1, colourTypes[lastCol], down, 2,
+                 x + aboveCol, 1, colourTypes[aboveCol], up, 2,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(x + 1 * MESHCOLS + firstCol, 1, colourTypes[firstCol], up, 3,
+                 x + (chunkRows + 1) * MESHCOLS + belowCol, 1, colourTypes[belowCol], down, 3,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
+
+//Start writing a checkpoint of this chunk without waiting for the file system.
+//The chunk is copied aside and written with a non-blocking collective write into
+//the checkpoint file that was not used last, so the previous one stays valid until
+//this one is finished. All ranks must call this at the same iteration.
+void startCheckpoint(Checkpoint* ckpt, float* chunk, MPI_Offset meshOffset, long points, int itrCount, float norm, const int MESHROWS, const int MESHCOLS) {
+    char fileName[32];
+
+    //only one checkpoint in flight at a time
+    finishCheckpoint(ckpt, MESHROWS, MESHCOLS);
+
+    ckpt->file = 1 - ckpt->file;
+    ckpt->itrCount = itrCount;
+    ckpt->norm = norm;
+    memcpy(ckpt->buffer, chunk, points * sizeof(float));
+
+    //the header is left empty until the data is on disk, so a half written file is never picked up
+    snprintf(fileName, sizeof(fileName), "jacobi_ckpt.%d", ckpt->file);
+    MPI_File_open(MPI_COMM_WORLD, fileName, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &ckpt->fh);
+    MPI_File_set_size(ckpt->fh, 0);
+    MPI_File_iwrite_at_all(ckpt->fh, CKPT_HEADER + meshOffset * sizeof(float), ckpt->buffer, points, MPI_FLOAT, &ckpt->request);
+    ckpt->pending = 1;
+}
+
+//Wait for the pending checkpoint (if any), then mark it complete by writing its header.
+//Collective, like startCheckpoint.
+void finishCheckpoint(Checkpoint* ckpt, const int MESHROWS, const int MESHCOLS) {
+    char header[CKPT_HEADER];
+    int rank;
+
+    if (!ckpt->pending) return;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Wait(&ckpt->request, MPI_STATUS_IGNORE);
+
+    if (rank == 0) {
+        memset(header, ' ', sizeof(header));
+        header[snprintf(header, sizeof(header) - 1, "JACOBI ckpt %d %d %d %e",
+                        MESHROWS, MESHCOLS, ckpt->itrCount, ckpt->norm)] = ' ';
+        header[sizeof(header) - 1] = '\n';
+        MPI_File_write_at(ckpt->fh, 0, header, sizeof(header), MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&ckpt->fh);
+    ckpt->pending = 0;
+}
+
+//Load this chunk from the newest complete checkpoint file.
+//Returns 0 (and leaves chunk untouched) when there is no usable checkpoint.
+int readCheckpoint(float* chunk, MPI_Offset meshOffset, long points, int* itrCount, float* norm, int* file, const int MESHROWS, const int MESHCOLS) {
+    int rank, f;
+    int best[2] = { -1, 0 };    //{file, iteration} of the newest checkpoint
+    float bestNorm = 0.0;
+    char fileName[32];
+    MPI_File fh;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    //the master looks at both headers and tells everyone which file to use
+    if (rank == 0) {
+        for (f = 0; f < 2; f++) {
+            char header[CKPT_HEADER + 1] = { 0 };
+            int rows, cols, itr;
+            float n;
+            FILE* fp;
+
+            snprintf(fileName, sizeof(fileName), "jacobi_ckpt.%d", f);
+            fp = fopen(fileName, "rb");
+            if (fp == NULL) continue;
+            if (fread(header, 1, CKPT_HEADER, fp) == CKPT_HEADER &&
+                sscanf(header, "JACOBI ckpt %d %d %d %e", &rows, &cols, &itr, &n) == 4 &&
+                rows == MESHROWS && cols == MESHCOLS && itr > best[1]) {
+                best[0] = f;
+                best[1] = itr;
+                bestNorm = n;
+            }
+            fclose(fp);
+        }
+    }
+    MPI_Bcast(best, 2, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&bestNorm, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    if (best[0] < 0) return 0;
+
+    snprintf(fileName, sizeof(fileName), "jacobi_ckpt.%d", best[0]);
+    MPI_File_open(MPI_COMM_WORLD, fileName, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    MPI_File_read_at_all(fh, CKPT_HEADER + meshOffset * sizeof(float), chunk, points, MPI_FLOAT, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    *file = best[0];
+    *itrCount = best[1];
+    *norm = bestNorm;
+    return 1;
+}
+
+//Compare the final mesh with a float32 raw file written by an earlier run (output=raw),
+//normally a run with the default float storage and the same epsilon.
+//Prints the largest and the RMS difference and how many PPM pixels would change.
+void accuracyReport(float* chunk, MPI_Offset meshOffset, long points, const char* reference, const int MESHROWS, const int MESHCOLS) {
+    int rank;
+    long i;
+    int info[2] = { 0, 0 };     //{reference usable, its iteration count}
+    double local[2] = { 0.0, 0.0 }, global[2];     //{sum of squared differences, pixels that differ}
+    float maxDiff = 0.0, gMaxDiff;
+    MPI_File fh;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    //the master checks the header so every rank agrees on whether to read it
+    if (rank == 0) {
+        char header[CKPT_HEADER + 1] = { 0 };
+        int rows, cols;
+        FILE* fp = fopen(reference, "rb");
+
+        if (fp != NULL) {
+            if (fread(header, 1, CKPT_HEADER, fp) == CKPT_HEADER &&
+                sscanf(header, "JACOBI float32 %d %d %d", &rows, &cols, &info[1]) == 3 &&
+                rows == MESHROWS && cols == MESHCOLS)
+                info[0] = 1;
+            fclose(fp);
+        }
+        if (!info[0]) printf("Accuracy report skipped: %s is not a %dx%d float32 raw file\n", reference, MESHROWS, MESHCOLS);
+    }
+    MPI_Bcast(info, 2, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!info[0]) return;
+
+    float* ref = (float*)malloc(points * sizeof(float));
+    MPI_File_open(MPI_COMM_WORLD, (char*)reference, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    MPI_File_read_at_all(fh, CKPT_HEADER + meshOffset * sizeof(float), ref, points, MPI_FLOAT, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    for (i = 0; i < points; i++) {
+        float d = fabsf(chunk[i] - ref[i]);
+
+        if (d > maxDiff) maxDiff = d;
+        local[0] += (double)d * d;
+        if ((unsigned char)lerp(0.0, 255.0, chunk[i]) != (unsigned char)lerp(0.0, 255.0, ref[i])) local[1] += 1.0;
+    }
+    free(ref);
+
+    MPI_Reduce(&maxDiff, &gMaxDiff, 1, MPI_FLOAT, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local, global, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("Accuracy against %s (%d iterations):\n", reference, info[1]);
+        printf("  max |diff| %e, RMS diff %e, %.0f of %ld pixels differ\n",
+               gMaxDiff, sqrt(global[0] / ((double)MESHROWS * MESHCOLS)), global[1], (long)MESHROWS * MESHCOLS);
+    }
+}
+
+//Allocate this rank's rows of one mesh buffer in a shared window over nodeComm and return
+//it laid out like the malloc'd chunk (row 0 and row chunkRows + 1 are the ghost rows).
+//The window is contiguous across the node, so a ghost row next to an attached neighbour is
+//not allocated here: it is that neighbour's boundary row, right before or after our rows.
+//The window stays in a passive access epoch (lock_all) until it is freed, for syncShared.
+float* sharedChunk(int chunkRows, int attachedUp, int attachedDown, MPI_Comm nodeComm, MPI_Win* win, const int MESHCOLS) {
+    float* base;
+    MPI_Aint bytes = (MPI_Aint)(chunkRows + !attachedUp + !attachedDown) * MESHCOLS * sizeof(float);
+
+    MPI_Win_allocate_shared(bytes, sizeof(float), MPI_INFO_NULL, nodeComm, &base, win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+
+    return attachedUp ? base - MESHCOLS : base;
+}
+
+//Make the rows written by this rank visible to the other ranks of the node and wait for
+//them to do the same (the MPI-3 shared memory pattern: sync, barrier, sync)
+void syncShared(MPI_Win* windows, MPI_Comm nodeComm) {
+    MPI_Win_sync(windows[0]);
+    MPI_Win_sync(windows[1]);
+    MPI_Barrier(nodeComm);
+    MPI_Win_sync(windows[0]);
+    MPI_Win_sync(windows[1]);
+}
+
+//Move row boundaries so that every rank gets a share of the interior rows proportional to its
+//speed (interior rows per second of stencil time since the last call), then migrate the rows
+//with one MPI_Alltoallv. Nothing moves while the stencil times are within BALANCE_TOLERANCE.
+//xLocal and xNew are reallocated for the new chunk; xNew gets a copy of xLocal and the ghost
+//rows are left for the next halo exchange. The master logs every migration.
+//Returns the number of rows that crossed a rank boundary (the same on every rank).
+//Collective over MPI_COMM_WORLD.
+int rebalanceRows(float** xLocal, float** xNew, int* chunkRows, int* firstRow, double stencilTime, int itrCount, const int MESHROWS, const int MESHCOLS) {
+    int rank, commSize, p, moved = 0, slowest = 0;
+    double sumTime = 0.0, maxTime = 0.0, sumSpeed = 0.0, predMax = 0.0, predSum = 0.0;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &commSize);
+
+    double* times = (double*)malloc(commSize * 2 * sizeof(double));     //stencil time, then speed, of every rank
+    double* speed = times + commSize;
+    int* rows = (int*)malloc(commSize * 8 * sizeof(int));       //old rows, new rows, old and new first row, alltoallv counts
+    int* newRows = rows + commSize;
+    int* oldStart = rows + 2 * commSize;
+    int* newStart = rows + 3 * commSize;
+    int* sendCounts = rows + 4 * commSize;
+    int* sendDispls = rows + 5 * commSize;
+    int* recvCounts = rows + 6 * commSize;
+    int* recvDispls = rows + 7 * commSize;
+
+    MPI_Allgather(&stencilTime, 1, MPI_DOUBLE, times, 1, MPI_DOUBLE, MPI_COMM_WORLD);
+    MPI_Allgather(chunkRows, 1, MPI_INT, rows, 1, MPI_INT, MPI_COMM_WORLD);
+
+    //the global boundary rows on the first and last rank are not computed, so they do not count as work
+    for (p = 0; p < commSize; p++) {
+        int work = rows[p] - (p == 0) - (p == commSize - 1);
+
+        sumTime += times[p];
+        if (times[p] > maxTime) {
+            maxTime = times[p];
+            slowest = p;
+        }
+        speed[p] = (times[p] > 0.0) ? work / times[p] : 0.0;
+        sumSpeed += speed[p];
+    }
+
+    //every rank sees the same numbers, so they all take the same branch
+    if (sumSpeed <= 0.0 || maxTime * commSize < BALANCE_TOLERANCE * sumTime) {
+        free(times);
+        free(rows);
+        return 0;
+    }
+
+    //new interior row boundaries from the cumulative speed; at least one interior row per rank
+    int interior = MESHROWS - 2, prev = 0;
+    double cumSpeed = 0.0;
+    for (p = 0; p < commSize; p++) {
+        int bound;
+
+        cumSpeed += speed[p];
+        bound = (p == commSize - 1) ? interior : (int)(interior * cumSpeed / sumSpeed + 0.5);
+        if (bound < prev + 1) bound = prev + 1;
+        if (bound > interior - (commSize - 1 - p)) bound = interior - (commSize - 1 - p);
+        newRows[p] = bound - prev + (p == 0) + (p == commSize - 1);
+        prev = bound;
+
+        double predicted = (newRows[p] - (p == 0) - (p == commSize - 1)) / speed[p];
+        predSum += predicted;
+        if (predicted > predMax) predMax = predicted;
+    }
+
+    oldStart[0] = newStart[0] = 0;
+    for (p = 1; p < commSize; p++) {
+        oldStart[p] = oldStart[p - 1] + rows[p - 1];
+        newStart[p] = newStart[p - 1] + newRows[p - 1];
+        moved += abs(newStart[p] - oldStart[p]);
+    }
+
+    if (moved == 0) {
+        free(times);
+        free(rows);
+        return 0;
+    }
+
+    if (rank == 0) {
+        printf("Rebalance at iteration %d: stencil imbalance %.2f (rank %d slowest), %d rows moved, predicted imbalance %.2f\n",
+               itrCount, maxTime * commSize / sumTime, slowest, moved, predMax * commSize / predSum);
+        printf("  rows:");
+        for (p = 0; p < commSize; p++) printf(" %d", newRows[p]);
+        printf("\n");
+    }
+
+    //my old rows that fall into each rank's new range, and the old rows of each rank that fall into my new range
+    for (p = 0; p < commSize; p++) {
+        int lo = (oldStart[rank] > newStart[p]) ? oldStart[rank] : newStart[p];
+        int hi = (oldStart[rank] + rows[rank] < newStart[p] + newRows[p]) ? oldStart[rank] + rows[rank] : newStart[p] + newRows[p];
+        sendCounts[p] = (hi > lo) ? (hi - lo) * MESHCOLS : 0;
+        sendDispls[p] = (hi > lo) ? (lo - oldStart[rank]) * MESHCOLS : 0;
+
+        lo = (oldStart[p] > newStart[rank]) ? oldStart[p] : newStart[rank];
+        hi = (oldStart[p] + rows[p] < newStart[rank] + newRows[rank]) ? oldStart[p] + rows[p] : newStart[rank] + newRows[rank];
+        recvCounts[p] = (hi > lo) ? (hi - lo) * MESHCOLS : 0;
+        recvDispls[p] = (hi > lo) ? (lo - newStart[rank]) * MESHCOLS : 0;
+    }
+
+    float* chunk = (float*)malloc((size_t)(newRows[rank] + 2) * MESHCOLS * sizeof(float));
+    MPI_Alltoallv(*xLocal + (1 * MESHCOLS), sendCounts, sendDispls, MPI_FLOAT,
+                  chunk + (1 * MESHCOLS), recvCounts, recvDispls, MPI_FLOAT, MPI_COMM_WORLD);
+
+    free(*xLocal);
+    free(*xNew);
+    *xLocal = chunk;
+    *xNew = (float*)malloc((size_t)(newRows[rank] + 2) * MESHCOLS * sizeof(float));
+    memcpy(*xNew, chunk, (newRows[rank] + 2) * MESHCOLS * sizeof(float));
+
+    *chunkRows = newRows[rank];
+    *firstRow = newStart[rank];
+
+    free(times);
+    free(rows);
+    return moved;
 }
 
 //linear interpolation between 2 values.
@@ -248,9 +1075,9 @@ float lerp(float from, float to, float t) {
 }
 
 //calculates and returns how many rows that a process with a certain rank should get
-int getChunkRows(int rank, int commSize, const int MESHSIZE){
-    int chunkRows = MESHSIZE / commSize;
-    int remainder = MESHSIZE % commSize;
+int getChunkRows(int rank, int commSize, const int MESHROWS){
+    int chunkRows = MESHROWS / commSize;
+    int remainder = MESHROWS % commSize;
 
     if(rank < remainder){   //the first remainder processes will get one extra row of data
         return chunkRows + 1;
@@ -260,6 +1087,6 @@ int getChunkRows(int rank, int commSize, const int MESHSIZE){
 }
 
 //calculates and returns how many elements that a process with a certain rank has in its chunk
-int getChunkSize(int rank, int commSize, const int MESHSIZE){
-    return getChunkRows(rank, commSize, MESHSIZE) * MESHSIZE;
+long getChunkSize(int rank, int commSize, const int MESHROWS, const int MESHCOLS){
+    return (long)getChunkRows(rank, commSize, MESHROWS) * MESHCOLS;
 }
\ No newline at end of file
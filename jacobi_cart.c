@@ -0,0 +1,277 @@
+/* Jacobi Iterations | 2D block decomposition (MPI_Cart_create)
+*  Same problem as jacobi.c, but the mesh is split into a grid of blocks
+*  instead of row strips. Column halos are strided, so they are described
+*  with an MPI_Type_vector and sent without packing.
+*
+*  mpicc jacobi_cart.c -o jacobi_cart -lm
+*  mpirun -np <N> ./jacobi_cart [epsilon] [max_iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mpi.h"
+
+float lerp(float from, float to, float t);
+void writeToPPM(float* mesh, int iterations, const int MESHSIZE);
+int getBlockExtent(int coord, int dimSize, const int MESHSIZE);
+int getBlockOffset(int coord, int dimSize, const int MESHSIZE);
+
+int main(int argc, char **argv)
+{
+    const int MESHSIZE = 1000;                //size of the mesh to compute
+
+    const float NORTH_BOUND = 100.0;        //north bounding value for the mesh
+    const float SOUTH_BOUND = 100.0;        //south bounding value for the mesh
+    const float EAST_BOUND = 0.0;          //east bounding value for the mesh
+    const float WEST_BOUND = 0.0;          //west bounding value for the mesh
+    const float INTERIOR_AVG =              //value to initialize interior mesh points with
+        (NORTH_BOUND + SOUTH_BOUND + EAST_BOUND + WEST_BOUND) / 4.0;    //average the 4 bounds
+
+    /*
+    rank: rank of the current process in the cartesian communicator
+    commSize: Number of processes in the MPI communicator
+    dims: number of blocks along rows (dims[0]) and columns (dims[1])
+    coords: position of this process in the block grid
+    north, south, west, east: neighbour ranks (MPI_PROC_NULL on the mesh border)
+    blockRows, blockCols: size of this process block, without ghost cells
+    rowOffset, colOffset: global position of the first point of the block
+    width: row stride of the local arrays (blockCols plus two ghost columns)
+    rFirst, rLast, cFirst, cLast: bounds of the points updated by this process
+    */
+    int        rank, commSize, r, c, itrCount;
+    int        dims[2] = {0, 0}, periods[2] = {0, 0}, coords[2];
+    int        north, south, west, east;
+    int        blockRows, blockCols, rowOffset, colOffset, width;
+    int        rFirst, rLast, cFirst, cLast;
+    float      diffNorm, gDiffNorm;
+    MPI_Comm   cartComm;
+    MPI_Datatype rowType, colType, blockType;
+
+    float*     xLocal;     //stores local block of mesh
+    float*     xNew;       //stores new local block of mesh
+    float*     xFull;      //used to assemble the blocks into a full mesh
+
+    float epsilon;          //threshold for gDiffNorm; used to stop the Jacobi iteration loop
+    int maxIterations;      //threshold for itrCount; used to stop the Jacobi iteration loop
+
+    double start, stop;     //timer variables
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &commSize);
+
+    //build the 2D process grid; MPI picks the most square factorization of commSize
+    MPI_Dims_create(commSize, 2, dims);
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 1, &cartComm);
+    MPI_Comm_rank(cartComm, &rank);
+    MPI_Cart_coords(cartComm, rank, 2, coords);
+    MPI_Cart_shift(cartComm, 0, 1, &north, &south);
+    MPI_Cart_shift(cartComm, 1, 1, &west, &east);
+
+    //check that we have enough command line arguments
+    if (argc < 3) {
+        if (rank == 0) {
+            printf("Please specify the correct number of arguments.\n");
+            printf("Usage: jacobi_cart [epsilon] [max_iterations]\n");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    epsilon = strtod(argv[1], NULL);
+    maxIterations = strtol(argv[2], NULL, 10);
+
+    blockRows = getBlockExtent(coords[0], dims[0], MESHSIZE);
+    blockCols = getBlockExtent(coords[1], dims[1], MESHSIZE);
+    rowOffset = getBlockOffset(coords[0], dims[0], MESHSIZE);
+    colOffset = getBlockOffset(coords[1], dims[1], MESHSIZE);
+    width = blockCols + 2;
+
+    //allocate the local blocks with a ghost ring on every side
+    xLocal = (float*)malloc((blockRows + 2) * width * sizeof(float));
+    xNew = (float*)malloc((blockRows + 2) * width * sizeof(float));
+    if (rank == 0) xFull = (float*)malloc(MESHSIZE * MESHSIZE * sizeof(float));
+
+    //a row halo is contiguous, a column halo has one float every width floats
+    MPI_Type_contiguous(blockCols, MPI_FLOAT, &rowType);
+    MPI_Type_commit(&rowType);
+    MPI_Type_vector(blockRows, 1, width, MPI_FLOAT, &colType);
+    MPI_Type_commit(&colType);
+    //the block interior, used to send the result to the master
+    MPI_Type_vector(blockRows, blockCols, width, MPI_FLOAT, &blockType);
+    MPI_Type_commit(&blockType);
+
+    if (rank == 0) {
+        printf("Jacobi Iterations (MPI, %d x %d blocks)\n", dims[0], dims[1]);
+    }
+
+    /* Blocks on the mesh border keep their outermost row/column fixed */
+    rFirst = (north == MPI_PROC_NULL) ? 2 : 1;
+    rLast  = (south == MPI_PROC_NULL) ? blockRows - 1 : blockRows;
+    cFirst = (west == MPI_PROC_NULL) ? 2 : 1;
+    cLast  = (east == MPI_PROC_NULL) ? blockCols - 1 : blockCols;
+
+    /* Fill the data using global coordinates; north and south override the corners like in jacobi.c */
+    for (r = 0; r < blockRows + 2; r++) {
+        int gr = rowOffset + r - 1;
+        for (c = 0; c < width; c++) {
+            int gc = colOffset + c - 1;
+            float value = INTERIOR_AVG;
+
+            if (gc == 0) value = WEST_BOUND;
+            if (gc == MESHSIZE - 1) value = EAST_BOUND;
+            if (gr == 0) value = NORTH_BOUND;
+            if (gr == MESHSIZE - 1) value = SOUTH_BOUND;
+
+            xLocal[r * width + c] = value;
+        }
+    }
+    memcpy(xNew, xLocal, (blockRows + 2) * width * sizeof(float));
+
+    if (rank == 0)   //start the timer on the master
+        start = MPI_Wtime();
+
+    //Jacobi iteration computation loop
+    itrCount = 0;
+    do {
+        /* Exchange the four halos; MPI_PROC_NULL neighbours turn into no-ops */
+        MPI_Sendrecv(xLocal + 1 * width + 1, 1, rowType, north, 0,
+                     xLocal + (blockRows + 1) * width + 1, 1, rowType, south, 0,
+                     cartComm, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(xLocal + blockRows * width + 1, 1, rowType, south, 1,
+                     xLocal + 0 * width + 1, 1, rowType, north, 1,
+                     cartComm, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(xLocal + 1 * width + 1, 1, colType, west, 2,
+                     xLocal + 1 * width + blockCols + 1, 1, colType, east, 2,
+                     cartComm, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(xLocal + 1 * width + blockCols, 1, colType, east, 3,
+                     xLocal + 1 * width + 0, 1, colType, west, 3,
+                     cartComm, MPI_STATUS_IGNORE);
+
+        /* Compute new values (but not on boundary) */
+        itrCount++;
+        diffNorm = 0.0;
+        for (r = rFirst; r <= rLast; r++)
+            for (c = cFirst; c <= cLast; c++) {
+                xNew[r * width + c] = (xLocal[r * width + c + 1] + xLocal[r * width + c - 1] +     //new value computed as the average of its 4 neighbors
+                    xLocal[(r + 1) * width + c] + xLocal[(r - 1) * width + c]) / 4.0;
+                diffNorm += (xNew[r * width + c] - xLocal[r * width + c]) *           //compute diffNorm sum
+                            (xNew[r * width + c] - xLocal[r * width + c]);
+            }
+
+        //swap new to local using pointers
+        float* tmp = xLocal;
+        xLocal = xNew;
+        xNew = tmp;
+
+        //reduce value for diffNorm
+        MPI_Allreduce(&diffNorm, &gDiffNorm, 1, MPI_FLOAT, MPI_SUM, cartComm);
+        gDiffNorm = sqrt(gDiffNorm);
+        if (rank == 0 && itrCount % 1000 == 0) printf("At iteration %d, diff is %e\n", itrCount,
+                               gDiffNorm);
+    } while (gDiffNorm > epsilon && itrCount < maxIterations);
+
+    //assemble the blocks into the full mesh and write to ppm
+    if (rank == 0) {
+        int proc;
+
+        //copy the master block into the full mesh
+        for (r = 0; r < blockRows; r++)
+            memcpy(xFull + (rowOffset + r) * MESHSIZE + colOffset,
+                   xLocal + (r + 1) * width + 1, blockCols * sizeof(float));
+
+        for (proc = 1; proc < commSize; proc++) {
+            int procCoords[2];
+            MPI_Datatype fullBlockType;
+
+            //each block lands in the full mesh with a stride of MESHSIZE
+            MPI_Cart_coords(cartComm, proc, 2, procCoords);
+            MPI_Type_vector(getBlockExtent(procCoords[0], dims[0], MESHSIZE),
+                            getBlockExtent(procCoords[1], dims[1], MESHSIZE),
+                            MESHSIZE, MPI_FLOAT, &fullBlockType);
+            MPI_Type_commit(&fullBlockType);
+            MPI_Recv(xFull + getBlockOffset(procCoords[0], dims[0], MESHSIZE) * MESHSIZE
+                           + getBlockOffset(procCoords[1], dims[1], MESHSIZE),
+                     1, fullBlockType, proc, 0, cartComm, MPI_STATUS_IGNORE);
+            MPI_Type_free(&fullBlockType);
+        }
+
+        //stop the timer, because the calculation is complete
+        stop = MPI_Wtime();
+
+        printf("%d Jacobi iterations took %f seconds.\n", itrCount, stop - start);
+
+        //write the full mesh to ppm output file
+        writeToPPM(xFull, itrCount, MESHSIZE);
+    }
+    else {
+        //send the block interior to master
+        MPI_Send(xLocal + 1 * width + 1, 1, blockType, 0, 0, cartComm);
+    }
+
+    MPI_Type_free(&rowType);
+    MPI_Type_free(&colType);
+    MPI_Type_free(&blockType);
+    MPI_Comm_free(&cartComm);
+
+    //free our dynamic memory
+    free(xLocal);
+    free(xNew);
+    if (rank == 0) free(xFull);
+
+    if (rank == 0) printf("<normal termination>\n");
+
+    MPI_Finalize();
+    return 0;
+}
+
+//Write our PPM image from a 2d array
+void writeToPPM(float* mesh, int iterations, const int MESHSIZE) {
+    FILE* fp = fopen("jacobi.ppm", "w");
+
+    fprintf(fp, "P3 %d %d 255\n", MESHSIZE, MESHSIZE);
+    fprintf(fp, "# Jacobi MPI (2D blocks)\n");
+    fprintf(fp, "#This image took %d iterations to converge.\n", iterations);
+
+    int r, c;
+    for (r = 0; r < MESHSIZE; r++) {
+        for (c = 0; c < MESHSIZE; c++) {
+            float temp = mesh[r * MESHSIZE + c];
+
+            int red = lerp(0.0, 255.0, temp);
+            int blue = lerp(255.0, 0.0, temp);
+
+            fprintf(fp, "%d 0 %d ", red, blue);
+            if (c % 5 == 4) {
+                //write a newline every 5th rgb value
+                fprintf(fp, "\n");
+            }
+        }
+    }
+
+    fclose(fp);
+}
+
+//linear interpolation between 2 values.
+//t is the point to interpolate at (divided by 100 because that is our maximum temp)
+float lerp(float from, float to, float t) {
+    return from + (t / 100.0f) * (to - from);
+}
+
+//calculates how many rows (or columns) the block at a grid coordinate gets
+//the first remainder blocks get one extra, like getChunkRows in jacobi.c
+int getBlockExtent(int coord, int dimSize, const int MESHSIZE) {
+    int extent = MESHSIZE / dimSize;
+    int remainder = MESHSIZE % dimSize;
+
+    return (coord < remainder) ? extent + 1 : extent;
+}
+
+//calculates the global index of the first row (or column) of the block at a grid coordinate
+int getBlockOffset(int coord, int dimSize, const int MESHSIZE) {
+    int extent = MESHSIZE / dimSize;
+    int remainder = MESHSIZE % dimSize;
+
+    return coord * extent + (coord < remainder ? coord : remainder);
+}
@@ -0,0 +1,257 @@
+/* Jacobi Iterations | hybrid MPI + OpenMP
+*  Row strips across ranks like jacobi.c, and the OpenMP stencil of
+*  jacobi_omp.c inside each rank. Only the master thread of each rank
+*  talks to MPI (MPI_THREAD_FUNNELED).
+*
+*  mpicc -fopenmp jacobi_hybrid.c -o jacobi_hybrid -lm
+*  The launcher decides how many ranks go on each node, e.g. 2 nodes with 4 ranks each:
+*  srun -N 2 --ntasks-per-node=4 --cpus-per-task=<threads> ./jacobi_hybrid 1e-4 7000 <threads>
+*  mpirun -np 8 --map-by ppr:4:node:pe=<threads> ./jacobi_hybrid 1e-4 7000 <threads>
+*  Passing "auto" (or 0) as threads splits the node cores evenly between the ranks on it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <omp.h>
+#include "mpi.h"
+
+float lerp(float from, float to, float t);
+void writeToPPM(float* mesh, int iterations, const int MESHSIZE);
+int getChunkRows(int rank, int commSize, const int MESHSIZE);
+int getChunkSize(int rank, int commSize, const int MESHSIZE);
+
+int main(int argc, char **argv)
+{
+    const int MESHSIZE = 1000;                //size of the mesh to compute
+
+    const float NORTH_BOUND = 100.0;        //north bounding value for the mesh
+    const float SOUTH_BOUND = 100.0;        //south bounding value for the mesh
+    const float EAST_BOUND = 0.0;          //east bounding value for the mesh
+    const float WEST_BOUND = 0.0;          //west bounding value for the mesh
+    const float INTERIOR_AVG =              //value to initialize interior mesh points with
+        (NORTH_BOUND + SOUTH_BOUND + EAST_BOUND + WEST_BOUND) / 4.0;    //average the 4 bounds
+
+    /*
+    provided: thread support level granted by MPI_Init_thread
+    nodeComm: ranks that share this node (used to count ranks per node)
+    nodeRank, ranksPerNode: position and count of this rank among the ranks of its node
+    threads: OpenMP threads used by this rank for the stencil
+    */
+    int        rank, commSize, r, c, itrCount;
+    int        rFirst, rLast;
+    int        provided;
+    int        nodeRank, ranksPerNode, threads;
+    MPI_Comm   nodeComm;
+    MPI_Status status;
+    float      diffNorm, gDiffNorm;
+
+    float*     xLocal;     //stores local chunk of mesh
+    float*     xNew;       //stores new local chunk of mesh
+    float*     xFull;      //used to assemble the chunks into a full mesh
+
+    float epsilon;          //threshold for gDiffNorm; used to stop the Jacobi iteration loop
+    int maxIterations;      //threshold for itrCount; used to stop the Jacobi iteration loop
+
+    double start, stop;     //timer variables
+
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &commSize);
+
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) printf("This MPI library does not support MPI_THREAD_FUNNELED.\n");
+        MPI_Finalize();
+        return 0;
+    }
+
+    //check that we have enough command line arguments
+    if (argc < 4) {
+        if (rank == 0) {
+            printf("Please specify the correct number of arguments.\n");
+            printf("Usage: jacobi_hybrid [epsilon] [max_iterations] [threads_per_rank|auto]\n");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    //count the ranks placed on this node by the launcher
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+    MPI_Comm_rank(nodeComm, &nodeRank);
+    MPI_Comm_size(nodeComm, &ranksPerNode);
+
+    epsilon = strtod(argv[1], NULL);
+    maxIterations = strtol(argv[2], NULL, 10);
+    threads = (strcmp(argv[3], "auto") == 0) ? 0 : strtol(argv[3], NULL, 10);
+    if (threads <= 0) {
+        //a rank the launcher bound to its own cores sees only those; otherwise it sees the
+        //whole node, whose cores are shared between the ranks on it
+        if (omp_get_num_procs() < sysconf(_SC_NPROCESSORS_ONLN))
+            threads = omp_get_num_procs();
+        else
+            threads = omp_get_num_procs() / ranksPerNode;
+        if (threads < 1) threads = 1;
+    }
+    omp_set_num_threads(threads);
+
+    const int CHUNKROWS = getChunkRows(rank, commSize, MESHSIZE);     //number of rows in a process chunk
+    const int CHUNKSIZE = getChunkSize(rank, commSize, MESHSIZE);     //number of floats in a process chunk
+
+    //allocate memory to 2d arrays
+    xLocal = (float*)malloc((CHUNKROWS + 2) * MESHSIZE * sizeof(float));
+    xNew = (float*)malloc((CHUNKROWS + 2) * MESHSIZE * sizeof(float));
+    if (rank == 0) xFull = (float*)malloc(MESHSIZE * MESHSIZE * sizeof(float));  //only the master needs to use this
+
+    if (rank == 0)
+        printf("Jacobi Iterations (MPI + OpenMP): %d ranks, %d ranks per node, %d threads per rank\n",
+               commSize, ranksPerNode, threads);
+
+    /* Note that top and bottom processes have one less row of interior
+       points */
+    rFirst = 1;
+    rLast  = CHUNKROWS;
+    if (rank == 0)        rFirst++;
+    if (rank == commSize - 1) rLast--;
+
+    /* Fill the data as specified */
+    for (r = 1; r <= CHUNKROWS; r++) {
+        for (c = 0; c < MESHSIZE; c++) {
+            xLocal[r * MESHSIZE + c] = INTERIOR_AVG;    //set value for interior points
+        }
+
+        xLocal[r * MESHSIZE + MESHSIZE - 1] = EAST_BOUND; //set value for east boundary
+        xLocal[r * MESHSIZE + 0] = WEST_BOUND;          //set value for west boundary
+    }
+    for (c = 0; c < MESHSIZE; c++) {
+        xLocal[(rFirst - 1) * MESHSIZE + c] = NORTH_BOUND;   //set value for north boundary
+        xLocal[(rLast + 1) * MESHSIZE + c] = SOUTH_BOUND;    //set value for south boundary
+    }
+    memcpy(xNew, xLocal, (CHUNKROWS + 2) * MESHSIZE * sizeof(float));
+
+    if (rank == 0)   //start the timer on the master
+        start = MPI_Wtime();
+
+    //Jacobi iteration computation loop
+    itrCount = 0;
+    do {
+        /* Halo exchange from the master thread, outside any parallel region */
+        if (rank < commSize - 1)
+            MPI_Send(xLocal + (CHUNKROWS * MESHSIZE), MESHSIZE, MPI_FLOAT, rank + 1, 0,
+                     MPI_COMM_WORLD);
+        if (rank > 0)
+            MPI_Recv(xLocal, MESHSIZE, MPI_FLOAT, rank - 1, 0,
+                     MPI_COMM_WORLD, &status);
+
+        if (rank > 0)
+            MPI_Send(xLocal + (1 * MESHSIZE), MESHSIZE, MPI_FLOAT, rank - 1, 1,
+                     MPI_COMM_WORLD);
+        if (rank < commSize - 1)
+            MPI_Recv(xLocal + ((CHUNKROWS + 1) * MESHSIZE), MESHSIZE, MPI_FLOAT, rank + 1, 1,
+                     MPI_COMM_WORLD, &status);
+
+        /* Compute new values (but not on boundary), rows split between the threads */
+        itrCount++;
+        diffNorm = 0.0;
+#pragma omp parallel for private(r,c) reduction(+:diffNorm)
+        for (r = rFirst; r <= rLast; r++)
+            for (c = 1; c < MESHSIZE - 1; c++) {
+                xNew[r * MESHSIZE + c] = (xLocal[r * MESHSIZE + c + 1] + xLocal[r * MESHSIZE + c - 1] +     //new value computed as the average of its 4 neighbors
+                    xLocal[(r + 1) * MESHSIZE + c] + xLocal[(r - 1) * MESHSIZE + c]) / 4.0;
+                diffNorm += (xNew[r * MESHSIZE + c] - xLocal[r * MESHSIZE + c]) *           //compute diffNorm sum
+                            (xNew[r * MESHSIZE + c] - xLocal[r * MESHSIZE + c]);
+            }
+
+        //swap new to local using pointers
+        float* tmp = xLocal;
+        xLocal = xNew;
+        xNew = tmp;
+
+        //reduce value for diffNorm
+        MPI_Allreduce(&diffNorm, &gDiffNorm, 1, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD);
+        gDiffNorm = sqrt(gDiffNorm);
+        if (rank == 0 && itrCount % 1000 == 0) printf("At iteration %d, diff is %e\n", itrCount,
+                               gDiffNorm);
+    } while (gDiffNorm > epsilon && itrCount < maxIterations);
+
+    //assemble mesh into full mesh and write to ppm
+    if (rank == 0) {
+        memcpy(xFull, xLocal + (1 * MESHSIZE), CHUNKSIZE * sizeof(float));
+
+        int proc;
+        int pointerOffset = 0;
+        for (proc = 1; proc < commSize; proc++) {
+            pointerOffset += getChunkSize(proc - 1, commSize, MESHSIZE);
+            MPI_Recv(xFull + pointerOffset, getChunkSize(proc, commSize, MESHSIZE), MPI_FLOAT, proc, 0, MPI_COMM_WORLD, &status);
+        }
+
+        //stop the timer, because the calculation is complete
+        stop = MPI_Wtime();
+
+        printf("%d Jacobi iterations took %f seconds.\n", itrCount, stop - start);
+
+        writeToPPM(xFull, itrCount, MESHSIZE);
+    }
+    else {
+        MPI_Send(xLocal + (1 * MESHSIZE), CHUNKSIZE, MPI_FLOAT, 0, 0, MPI_COMM_WORLD);
+    }
+
+    MPI_Comm_free(&nodeComm);
+
+    //free our dynamic memory
+    free(xLocal);
+    free(xNew);
+    if (rank == 0) free(xFull);
+
+    if (rank == 0) printf("<normal termination>\n");
+
+    MPI_Finalize();
+    return 0;
+}
+
+//Write our PPM image from a 2d array
+void writeToPPM(float* mesh, int iterations, const int MESHSIZE) {
+    FILE* fp = fopen("jacobi.ppm", "w");
+
+    fprintf(fp, "P3 %d %d 255\n", MESHSIZE, MESHSIZE);
+    fprintf(fp, "# Jacobi MPI + OpenMP\n");
+    fprintf(fp, "#This image took %d iterations to converge.\n", iterations);
+
+    int r, c;
+    for (r = 0; r < MESHSIZE; r++) {
+        for (c = 0; c < MESHSIZE; c++) {
+            float temp = mesh[r * MESHSIZE + c];
+
+            int red = lerp(0.0, 255.0, temp);
+            int blue = lerp(255.0, 0.0, temp);
+
+            fprintf(fp, "%d 0 %d ", red, blue);
+            if (c % 5 == 4) {
+                //write a newline every 5th rgb value
+                fprintf(fp, "\n");
+            }
+        }
+    }
+
+    fclose(fp);
+}
+
+//linear interpolation between 2 values.
+//t is the point to interpolate at (divided by 100 because that is our maximum temp)
+float lerp(float from, float to, float t) {
+    return from + (t / 100.0f) * (to - from);
+}
+
+//calculates and returns how many rows that a process with a certain rank should get
+int getChunkRows(int rank, int commSize, const int MESHSIZE) {
+    int chunkRows = MESHSIZE / commSize;
+    int remainder = MESHSIZE % commSize;
+
+    return (rank < remainder) ? chunkRows + 1 : chunkRows;
+}
+
+//calculates and returns how many elements that a process with a certain rank has in its chunk
+int getChunkSize(int rank, int commSize, const int MESHSIZE) {
+    return getChunkRows(rank, commSize, MESHSIZE) * MESHSIZE;
+}
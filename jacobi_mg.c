@@ -0,0 +1,454 @@
+/* Laplace solver | geometric multigrid V-cycle (MPI)
+*  Same problem as jacobi.c: fixed north/south/east/west bounds and a
+*  Laplace interior. A damped version of the Jacobi sweep smooths each
+*  level, residuals are restricted with full weighting and corrections are
+*  prolongated with bilinear interpolation.
+*
+*  Every level is split in row strips like jacobi.c. When a level gets too
+*  small to keep all ranks busy it is agglomerated onto fewer ranks (at
+*  least MIN_ROWS rows each); the others sit that level out.
+*
+*  Levels nest exactly when MESHSIZE - 1 is a power of two, so the mesh is
+*  1025 x 1025 here instead of the 1000 x 1000 of jacobi.c.
+*
+*  The stopping test uses ||r|| / 4, which is exactly the diffNorm that one
+*  Jacobi sweep of jacobi.c would report (its update is D^-1 r = r / 4), so
+*  the same epsilon means the same residual target. The levels are kept in
+*  double: in float the residual of this mesh cannot drop below about 4e-3
+*  (rounding of values near 50), which is above the usual 1e-4 target.
+*
+*  mpicc jacobi_mg.c -o jacobi_mg -lm
+*  mpirun -np <N> ./jacobi_mg [epsilon] [max_cycles]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mpi.h"
+
+#define MAX_LEVELS 16
+#define MIN_ROWS 16           //fewest rows per rank before a level is agglomerated onto fewer ranks
+#define PRE_SWEEPS 2          //smoothing sweeps before the coarse correction
+#define POST_SWEEPS 2         //smoothing sweeps after it
+#define SMOOTH_OMEGA 0.8     //damping of the Jacobi smoother (plain Jacobi does not damp the checkerboard mode)
+#define COARSE_SWEEPS 20      //sweeps used as the solver on the coarsest level
+
+//one grid of the hierarchy; rows and arrays are only set on the ranks that take part in it
+typedef struct {
+    int      n;         //points per side, boundary included
+    int      ranks;     //ranks 0..ranks-1 hold this level
+    int      rows;      //local rows (0 on ranks that sit this level out)
+    int      off;       //global index of the first local row
+    double   h2;        //squared grid spacing, relative to the finest level
+    MPI_Comm comm;      //communicator of the ranks holding this level (MPI_COMM_NULL otherwise)
+    double   *u, *f, *r, *tmp;    //solution (or correction), right hand side, residual, smoother scratch
+} Level;
+
+double lerp(double from, double to, double t);
+void writePPM(double* chunk, MPI_Offset meshOffset, int points, int iterations, const int MESHSIZE);
+int getChunkRows(int rank, int commSize, int n);
+int getChunkOffset(int rank, int commSize, int n);
+void setupLevel(Level* L, int n, double h2, int rank, int commSize);
+void exchangeHalo(Level* L, double* x);
+void smooth(Level* L, int sweeps, double omega);
+double residual(Level* L);
+void restrictResidual(Level* fine, Level* coarse, int commSize, int* counts);
+void prolongCorrection(Level* coarse, Level* fine, int commSize, int* counts);
+void vcycle(Level* levels, int l, int nLevels, int commSize, int* counts);
+
+int main(int argc, char **argv)
+{
+    const int MESHSIZE = 1025;               //size of the mesh to compute (2^k + 1 so the levels nest)
+
+    const double NORTH_BOUND = 100.0;        //north bounding value for the mesh
+    const double SOUTH_BOUND = 100.0;        //south bounding value for the mesh
+    const double EAST_BOUND = 0.0;          //east bounding value for the mesh
+    const double WEST_BOUND = 0.0;          //west bounding value for the mesh
+    const double INTERIOR_AVG =              //value to initialize interior mesh points with
+        (NORTH_BOUND + SOUTH_BOUND + EAST_BOUND + WEST_BOUND) / 4.0;    //average the 4 bounds
+
+    int        rank, commSize, r, c, l, cycle;
+    int        nLevels;
+    Level      levels[MAX_LEVELS];
+    int*       counts;     //scratch for the MPI_Alltoallv between levels (4 * commSize ints)
+    double     norm, gNorm;
+
+    double epsilon;          //residual target, in the units of the Jacobi diffNorm
+    int maxCycles;          //most V-cycles to run
+
+    double start, stop;     //timer variables
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &commSize);
+
+    if (argc < 3) {
+        if (rank == 0) {
+            printf("Please specify the correct number of arguments.\n");
+            printf("Usage: jacobi_mg [epsilon] [max_cycles]\n");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    epsilon = strtod(argv[1], NULL);
+    maxCycles = strtol(argv[2], NULL, 10);
+    counts = (int*)malloc(4 * commSize * sizeof(int));
+
+    //build the hierarchy: halve the mesh until only one interior point is left
+    nLevels = 0;
+    int n = MESHSIZE;
+    double h2 = 1.0;
+    while (nLevels < MAX_LEVELS) {
+        setupLevel(&levels[nLevels], n, h2, rank, commSize);
+        nLevels++;
+        if (n <= 3 || (n - 1) % 2 != 0) break;
+        n = (n - 1) / 2 + 1;
+        h2 *= 4.0;
+    }
+
+    if (rank == 0) {
+        printf("Multigrid V(%d,%d) with %d levels:", PRE_SWEEPS, POST_SWEEPS, nLevels);
+        for (l = 0; l < nLevels; l++) printf(" %d(%d)", levels[l].n, levels[l].ranks);
+        printf("\n");
+    }
+
+    /* Fill the finest level like jacobi.c; coarse levels hold corrections with zero bounds */
+    Level* fine = &levels[0];
+    for (r = 0; r < fine->rows + 2; r++) {
+        int gr = fine->off + r - 1;
+        for (c = 0; c < MESHSIZE; c++) {
+            double value = INTERIOR_AVG;
+
+            if (c == 0) value = WEST_BOUND;
+            if (c == MESHSIZE - 1) value = EAST_BOUND;
+            if (gr == 0) value = NORTH_BOUND;
+            if (gr == MESHSIZE - 1) value = SOUTH_BOUND;
+
+            fine->u[r * MESHSIZE + c] = value;
+        }
+    }
+    memcpy(fine->tmp, fine->u, (fine->rows + 2) * MESHSIZE * sizeof(double));
+
+    if (rank == 0) start = MPI_Wtime();
+
+    cycle = 0;
+    do {
+        vcycle(levels, 0, nLevels, commSize, counts);
+        cycle++;
+
+        norm = residual(fine);
+        MPI_Allreduce(&norm, &gNorm, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        gNorm = sqrt(gNorm) / 4.0;
+        if (rank == 0) printf("Cycle %d, residual (as Jacobi diff) is %e\n", cycle, gNorm);
+    } while (gNorm > epsilon && cycle < maxCycles);
+
+    if (rank == 0) {
+        stop = MPI_Wtime();
+        printf("%d V-cycles took %f seconds.\n", cycle, stop - start);
+    }
+
+    writePPM(fine->u + MESHSIZE, (MPI_Offset)fine->off * MESHSIZE, fine->rows * MESHSIZE, cycle, MESHSIZE);
+
+    for (l = 0; l < nLevels; l++) {
+        if (levels[l].comm == MPI_COMM_NULL) continue;
+        free(levels[l].u);
+        free(levels[l].f);
+        free(levels[l].r);
+        free(levels[l].tmp);
+        MPI_Comm_free(&levels[l].comm);
+    }
+    free(counts);
+
+    if (rank == 0) printf("<normal termination>\n");
+
+    MPI_Finalize();
+    return 0;
+}
+
+//allocate one level and decide which ranks hold it
+void setupLevel(Level* L, int n, double h2, int rank, int commSize) {
+    int size;
+
+    L->n = n;
+    L->h2 = h2;
+    L->ranks = n / MIN_ROWS;
+    if (L->ranks > commSize) L->ranks = commSize;
+    if (L->ranks < 1) L->ranks = 1;
+
+    MPI_Comm_split(MPI_COMM_WORLD, rank < L->ranks ? 0 : MPI_UNDEFINED, rank, &L->comm);
+
+    L->rows = 0;
+    L->off = 0;
+    L->u = L->f = L->r = L->tmp = NULL;
+    if (L->comm == MPI_COMM_NULL) return;
+
+    L->rows = getChunkRows(rank, L->ranks, n);
+    L->off = getChunkOffset(rank, L->ranks, n);
+
+    //zeroed: coarse corrections start from zero and have zero bounds
+    size = (L->rows + 2) * n;
+    L->u = (double*)calloc(size, sizeof(double));
+    L->f = (double*)calloc(size, sizeof(double));
+    L->r = (double*)calloc(size, sizeof(double));
+    L->tmp = (double*)calloc(size, sizeof(double));
+}
+
+//fill the ghost rows of x from the neighbours that hold the same level
+void exchangeHalo(Level* L, double* x) {
+    int rank;
+    MPI_Comm_rank(L->comm, &rank);
+
+    int up = (rank > 0) ? rank - 1 : MPI_PROC_NULL;
+    int down = (rank < L->ranks - 1) ? rank + 1 : MPI_PROC_NULL;
+
+    MPI_Sendrecv(x + L->rows * L->n, L->n, MPI_DOUBLE, down, 0,
+                 x, L->n, MPI_DOUBLE, up, 0, L->comm, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(x + 1 * L->n, L->n, MPI_DOUBLE, up, 1,
+                 x + (L->rows + 1) * L->n, L->n, MPI_DOUBLE, down, 1, L->comm, MPI_STATUS_IGNORE);
+}
+
+//local rows that hold interior points of the level
+static void interiorRows(Level* L, int* rFirst, int* rLast) {
+    *rFirst = (L->off == 0) ? 2 : 1;
+    *rLast = (L->off + L->rows == L->n) ? L->rows - 1 : L->rows;
+}
+
+//damped Jacobi sweeps: u += omega * ((neighbours + h^2 f) / 4 - u)
+//on the finest level f is 0 and omega 1 would be exactly the jacobi.c stencil
+void smooth(Level* L, int sweeps, double omega) {
+    int s, r, c, rFirst, rLast;
+    const int n = L->n;
+
+    interiorRows(L, &rFirst, &rLast);
+    for (s = 0; s < sweeps; s++) {
+        exchangeHalo(L, L->u);
+        for (r = rFirst; r <= rLast; r++)
+            for (c = 1; c < n - 1; c++) {
+                double jac = (L->u[r * n + c + 1] + L->u[r * n + c - 1] +
+                             L->u[(r + 1) * n + c] + L->u[(r - 1) * n + c] + L->h2 * L->f[r * n + c]) * 0.25;
+                L->tmp[r * n + c] = L->u[r * n + c] + omega * (jac - L->u[r * n + c]);
+            }
+
+        //swap; both arrays carry the same (fixed) boundary values
+        double* t = L->u;
+        L->u = L->tmp;
+        L->tmp = t;
+    }
+}
+
+//r = f - A u on the interior points (A u = (4u - neighbours) / h^2); returns the local sum of r^2
+double residual(Level* L) {
+    int r, c, rFirst, rLast;
+    const int n = L->n;
+    double norm = 0.0;
+
+    interiorRows(L, &rFirst, &rLast);
+    exchangeHalo(L, L->u);
+    for (r = rFirst; r <= rLast; r++)
+        for (c = 1; c < n - 1; c++) {
+            double res = L->f[r * n + c] - (4.0 * L->u[r * n + c] - L->u[r * n + c + 1] - L->u[r * n + c - 1] -
+                                           L->u[(r + 1) * n + c] - L->u[(r - 1) * n + c]) / L->h2;
+            L->r[r * n + c] = res;
+            norm += res * res;
+        }
+    return norm;
+}
+
+//rows [lo, hi) shared by two row ranges, as a count (0 when they do not overlap)
+static int overlapRows(int lo1, int hi1, int lo2, int hi2, int* lo) {
+    *lo = (lo1 > lo2) ? lo1 : lo2;
+    int hi = (hi1 < hi2) ? hi1 : hi2;
+    return (hi > *lo) ? hi - *lo : 0;
+}
+
+//full weighting of the fine residual into the coarse right hand side.
+//Each fine rank restricts the coarse rows whose centre row it owns, then one
+//MPI_Alltoallv moves them to the coarse ranks (which may be fewer).
+void restrictResidual(Level* fine, Level* coarse, int commSize, int* counts) {
+    int* sendCounts = counts;
+    int* sendDispls = counts + commSize;
+    int* recvCounts = counts + 2 * commSize;
+    int* recvDispls = counts + 3 * commSize;
+    const int n = fine->n, nc = coarse->n;
+    int p, lo, cLo = 0, cHi = 0, I, J;
+    double* buffer = NULL;
+
+    if (fine->comm != MPI_COMM_NULL) {
+        //coarse rows I with 2I in our fine rows, interior only
+        cLo = (fine->off + 1) / 2;
+        cHi = (fine->off + fine->rows + 1) / 2;
+        if (cLo < 1) cLo = 1;
+        if (cHi > nc - 1) cHi = nc - 1;
+
+        exchangeHalo(fine, fine->r);
+        buffer = (double*)calloc((cHi > cLo ? cHi - cLo : 0) * nc + 1, sizeof(double));
+        for (I = cLo; I < cHi; I++) {
+            int i = 2 * I - fine->off + 1;     //local fine row of the centre
+            for (J = 1; J < nc - 1; J++) {
+                int j = 2 * J;
+                double* rr = fine->r;
+                buffer[(I - cLo) * nc + J] =
+                    (4.0 * rr[i * n + j] +
+                     2.0 * (rr[(i - 1) * n + j] + rr[(i + 1) * n + j] + rr[i * n + j - 1] + rr[i * n + j + 1]) +
+                     rr[(i - 1) * n + j - 1] + rr[(i - 1) * n + j + 1] + rr[(i + 1) * n + j - 1] + rr[(i + 1) * n + j + 1]) / 16.0;
+            }
+        }
+    }
+
+    //both sides can work out every count from the two decompositions
+    for (p = 0; p < commSize; p++) {
+        sendCounts[p] = sendDispls[p] = recvCounts[p] = recvDispls[p] = 0;
+        if (fine->comm != MPI_COMM_NULL && p < coarse->ranks) {
+            sendCounts[p] = overlapRows(cLo, cHi, getChunkOffset(p, coarse->ranks, nc),
+                                        getChunkOffset(p, coarse->ranks, nc) + getChunkRows(p, coarse->ranks, nc), &lo) * nc;
+            sendDispls[p] = (lo - cLo) * nc;
+        }
+        if (coarse->comm != MPI_COMM_NULL && p < fine->ranks) {
+            int pLo = (getChunkOffset(p, fine->ranks, n) + 1) / 2;
+            int pHi = (getChunkOffset(p, fine->ranks, n) + getChunkRows(p, fine->ranks, n) + 1) / 2;
+            if (pLo < 1) pLo = 1;
+            if (pHi > nc - 1) pHi = nc - 1;
+            recvCounts[p] = overlapRows(pLo, pHi, coarse->off, coarse->off + coarse->rows, &lo) * nc;
+            recvDispls[p] = (lo - coarse->off + 1) * nc;
+        }
+        if (sendCounts[p] == 0) sendDispls[p] = 0;
+        if (recvCounts[p] == 0) recvDispls[p] = 0;
+    }
+
+    MPI_Alltoallv(buffer, sendCounts, sendDispls, MPI_DOUBLE,
+                  coarse->f, recvCounts, recvDispls, MPI_DOUBLE, MPI_COMM_WORLD);
+    free(buffer);
+
+    //the coarse problem solves for a correction, starting from zero
+    if (coarse->comm != MPI_COMM_NULL) {
+        memset(coarse->u, 0, (coarse->rows + 2) * nc * sizeof(double));
+        memset(coarse->tmp, 0, (coarse->rows + 2) * nc * sizeof(double));
+    }
+}
+
+//bilinear interpolation of the coarse correction, added to the fine solution.
+//One MPI_Alltoallv brings every fine rank the coarse rows around its own rows.
+void prolongCorrection(Level* coarse, Level* fine, int commSize, int* counts) {
+    int* sendCounts = counts;
+    int* sendDispls = counts + commSize;
+    int* recvCounts = counts + 2 * commSize;
+    int* recvDispls = counts + 3 * commSize;
+    const int n = fine->n, nc = coarse->n;
+    int p, lo, cLo = 0, cHi = 0, r, c;
+    double* e = NULL;
+
+    if (fine->comm != MPI_COMM_NULL) {
+        //fine row i needs coarse rows i/2 and (i+1)/2
+        cLo = fine->off / 2;
+        cHi = (fine->off + fine->rows) / 2 + 1;
+        if (cHi > nc) cHi = nc;
+        e = (double*)malloc((cHi - cLo) * nc * sizeof(double));
+    }
+
+    for (p = 0; p < commSize; p++) {
+        sendCounts[p] = sendDispls[p] = recvCounts[p] = recvDispls[p] = 0;
+        if (coarse->comm != MPI_COMM_NULL && p < fine->ranks) {
+            int pLo = getChunkOffset(p, fine->ranks, n) / 2;
+            int pHi = (getChunkOffset(p, fine->ranks, n) + getChunkRows(p, fine->ranks, n)) / 2 + 1;
+            if (pHi > nc) pHi = nc;
+            sendCounts[p] = overlapRows(pLo, pHi, coarse->off, coarse->off + coarse->rows, &lo) * nc;
+            sendDispls[p] = (lo - coarse->off + 1) * nc;
+        }
+        if (fine->comm != MPI_COMM_NULL && p < coarse->ranks) {
+            recvCounts[p] = overlapRows(cLo, cHi, getChunkOffset(p, coarse->ranks, nc),
+                                        getChunkOffset(p, coarse->ranks, nc) + getChunkRows(p, coarse->ranks, nc), &lo) * nc;
+            recvDispls[p] = (lo - cLo) * nc;
+        }
+        if (sendCounts[p] == 0) sendDispls[p] = 0;
+        if (recvCounts[p] == 0) recvDispls[p] = 0;
+    }
+
+    MPI_Alltoallv(coarse->u, sendCounts, sendDispls, MPI_DOUBLE,
+                  e, recvCounts, recvDispls, MPI_DOUBLE, MPI_COMM_WORLD);
+
+    if (fine->comm != MPI_COMM_NULL) {
+        int rFirst, rLast;
+        interiorRows(fine, &rFirst, &rLast);
+        for (r = rFirst; r <= rLast; r++) {
+            int i = fine->off + r - 1;
+            double* e0 = e + (i / 2 - cLo) * nc;             //coarse row at or above i
+            double* e1 = e + ((i + 1) / 2 - cLo) * nc;       //coarse row at or below i
+            for (c = 1; c < n - 1; c++) {
+                int J0 = c / 2, J1 = (c + 1) / 2;
+                fine->u[r * n + c] += 0.25 * (e0[J0] + e0[J1] + e1[J0] + e1[J1]);
+            }
+        }
+        free(e);
+    }
+}
+
+//one V-cycle from level l down to the coarsest and back; every rank calls it
+void vcycle(Level* levels, int l, int nLevels, int commSize, int* counts) {
+    Level* L = &levels[l];
+
+    if (l == nLevels - 1) {
+        //the coarsest level is tiny; sweeping it solves it
+        if (L->comm != MPI_COMM_NULL) smooth(L, COARSE_SWEEPS, 1.0);
+        return;
+    }
+
+    if (L->comm != MPI_COMM_NULL) {
+        smooth(L, PRE_SWEEPS, SMOOTH_OMEGA);
+        residual(L);
+    }
+    restrictResidual(L, &levels[l + 1], commSize, counts);
+    vcycle(levels, l + 1, nLevels, commSize, counts);
+    prolongCorrection(&levels[l + 1], L, commSize, counts);
+    if (L->comm != MPI_COMM_NULL) smooth(L, POST_SWEEPS, SMOOTH_OMEGA);
+}
+
+//Write our PPM image as binary P6 with collective MPI-IO (same layout as jacobi.c)
+void writePPM(double* chunk, MPI_Offset meshOffset, int points, int iterations, const int MESHSIZE) {
+    MPI_File fh;
+    char header[128];
+    int rank, i;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    int headerLen = snprintf(header, sizeof(header),
+        "P6\n#This image took %d V-cycles to converge.\n%d %d\n255\n", iterations, MESHSIZE, MESHSIZE);
+
+    unsigned char* pixels = (unsigned char*)malloc(points * 3 + 1);
+    for (i = 0; i < points; i++) {
+        pixels[3 * i + 0] = lerp(0.0, 255.0, chunk[i]);    //red
+        pixels[3 * i + 1] = 0;                             //green
+        pixels[3 * i + 2] = lerp(255.0, 0.0, chunk[i]);    //blue
+    }
+
+    MPI_File_open(MPI_COMM_WORLD, "jacobi.ppm", MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_File_set_size(fh, 0);
+    if (rank == 0) MPI_File_write_at(fh, 0, header, headerLen, MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(fh, headerLen + meshOffset * 3, pixels, points * 3, MPI_UNSIGNED_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    free(pixels);
+}
+
+//linear interpolation between 2 values.
+//t is the point to interpolate at (divided by 100 because that is our maximum temp)
+double lerp(double from, double to, double t) {
+    return from + (t / 100.0) * (to - from);
+}
+
+//calculates how many rows of an n-row level a rank gets (first remainder ranks get one extra)
+int getChunkRows(int rank, int commSize, int n) {
+    int chunkRows = n / commSize;
+    int remainder = n % commSize;
+
+    return (rank < remainder) ? chunkRows + 1 : chunkRows;
+}
+
+//calculates the global index of the first row a rank gets
+int getChunkOffset(int rank, int commSize, int n) {
+    int chunkRows = n / commSize;
+    int remainder = n % commSize;
+
+    return rank * chunkRows + (rank < remainder ? rank : remainder);
+}
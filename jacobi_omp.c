@@ -1,21 +1,43 @@
+// gcc -O2 -fopenmp jacobi_omp.c stencil.c -o jacobi_omp -lm
+// ./jacobi_omp [epsilon] [max_iterations] [threads] [tile_steps] [places=cores|threads|sockets] [bind=close|spread] [persistent]
+//              [size=linhas[xcolunas]] [bounds=n,s,e,w] [weak]
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
 #include <omp.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "stencil.h"
 
-void printMesh(float* meshArray, const int MESHSIZE);
+#define TILE_ROWS 64          //altura (em linhas) de cada faixa do kernel com blocagem temporal
+#define MAX_TILE_STEPS 32     //máximo de iterações avançadas dentro de uma faixa
+#define NORM_PAD 16           //floats por linha de cache, para as somas das threads não dividirem a mesma linha
+
+void printMesh(float* meshArray, const int MESHROWS, const int MESHCOLS);
+float sweep(float* xFull, float* xNew, const int MESHROWS, const int MESHCOLS, int reqThreads);
+void tiledSweeps(float* xFull, float* xNew, float* xSave, int steps, float* norms, const int MESHROWS, const int MESHCOLS, int reqThreads);
+float persistentSolve(float** xFull, float** xNew, float epsilon, int maxIterations, int* itrCount, const int MESHROWS, const int MESHCOLS, int reqThreads);
+void pinThreads(char** argv, const char* places, const char* bind);
+int currentNode(void);
+void placementReport(float* mesh, const char* name, int* firstRow, int* lastRow, int* threadNode, int nThreads, const int MESHROWS, const int MESHCOLS);
 
 int main(int argc, char** argv){
-    const int MESHSIZE = 2880;                //tamanho da malha a ser computada
+    //tamanho e limites da malha; size=, bounds= e weak mudam na execução
+    int MESHROWS = 2880;                //linhas da malha a ser computada
+    int MESHCOLS = 2880;                //colunas da malha
 
-    const float NORTH_BOUND = 100.0;        //Valor de limite norte para a malha
-    const float SOUTH_BOUND = 100.0;        //Valor de limite sul para a malha
-    const float EAST_BOUND = 0.0;          //east bounding value for the mesh
-    const float WEST_BOUND = 0.0;          //west bounding value for the mesh
-    const float INTERIOR_AVG =              //Valor para os pontos interiores da malha
-        (NORTH_BOUND + SOUTH_BOUND + EAST_BOUND + WEST_BOUND) / 4.0;    //Média dos valores de limite
+    float NORTH_BOUND = 100.0;        //Valor de limite norte para a malha
+    float SOUTH_BOUND = 100.0;        //Valor de limite sul para a malha
+    float EAST_BOUND = 0.0;          //east bounding value for the mesh
+    float WEST_BOUND = 0.0;          //west bounding value for the mesh
+    float INTERIOR_AVG;              //Valor para os pontos interiores da malha (média dos valores de limite)
+    int weak = 0;                    //MESHROWS vira linhas por thread: a malha cresce com o número de threads
+    size_t meshBytes;                //tamanho de cada matriz em bytes (64 bits: a malha pode passar de 2^31 pontos)
 
     int       r;            //indice de linha para iteração
     int       c;            //indice de coluna para iteração
@@ -29,6 +51,17 @@ int main(int argc, char** argv){
     int maxIterations;      //limite máximo de iterações
     
     int reqThreads;        //número de threads a serem usadas (fornecido na linha de comando)
+    int tileSteps;         //iterações por bloco temporal (0 ou 1 = varredura simples)
+    const char* places = NULL;   //valor de OMP_PLACES pedido na linha de comando
+    const char* bind = NULL;     //valor de OMP_PROC_BIND pedido na linha de comando
+    int persistent = 0;    //uma única região paralela para todas as iterações
+    int* firstRow;         //primeira linha inicializada (e calculada) por cada thread
+    int* lastRow;          //última linha inicializada por cada thread
+    int* threadNode;       //nó NUMA em que cada thread estava durante a inicialização
+    int i;
+
+    float* xSave = NULL;   //terceira malha do bloco temporal: com ela xFull fica intacta até o fim do bloco
+    float norms[MAX_TILE_STEPS];    //soma dos quadrados das diferenças de cada passo do bloco
 
     double start, stop;     //variáveis para medir o tempo de execução
 
@@ -37,66 +70,175 @@ int main(int argc, char** argv){
         //print usage information to head
         
         printf("Please specify the correct number of arguments.\n");
-        printf("Usage: jacobi_openmp [epsilon] [max_iterations] [threads]\n");
+        printf("Usage: jacobi_openmp [epsilon] [max_iterations] [threads] [tile_steps] [places=...] [bind=...] [persistent]\n");
+        printf("       [size=rows[xcols]] [bounds=n,s,e,w] [weak]\n");
        
         return 0;
     }
 
-    //Alocar memória para as matrizes
-    xFull = (float*)malloc(MESHSIZE * MESHSIZE * sizeof(float));
-    xNew = (float*)malloc(MESHSIZE * MESHSIZE * sizeof(float));
-
     //popular variáveis a partir da linha de comando
     epsilon = strtod(argv[1], NULL);
     maxIterations = strtol(argv[2], NULL, 10);
     reqThreads = strtol(argv[3], NULL, 10);
-
-
-    /* Inicializando as matrizes */
-    for (r = 0; r < MESHSIZE; r++) { //começa preenchendo o interior e os limites leste e oeste
-        for (c = 0; c < MESHSIZE; c++) { //passa por todas as posições
-            xFull[r * MESHSIZE + c] = INTERIOR_AVG;    //preenche o interior com a média dos valores de limite
+    tileSteps = 0;
+    for (i = 4; i < argc; i++) {
+        if (strncmp(argv[i], "places=", 7) == 0) places = argv[i] + 7;
+        else if (strncmp(argv[i], "bind=", 5) == 0) bind = argv[i] + 5;
+        else if (strcmp(argv[i], "persistent") == 0) persistent = 1;
+        else if (strncmp(argv[i], "size=", 5) == 0 && sscanf(argv[i] + 5, "%d", &MESHROWS) == 1) {
+            if (sscanf(argv[i] + 5, "%*dx%d", &MESHCOLS) != 1) MESHCOLS = MESHROWS;   //um número só: malha quadrada
+        }
+        else if (strncmp(argv[i], "bounds=", 7) == 0 &&
+                 sscanf(argv[i] + 7, "%f,%f,%f,%f", &NORTH_BOUND, &SOUTH_BOUND, &EAST_BOUND, &WEST_BOUND) == 4) ;   //o sscanf já leu os quatro limites
+        else if (strcmp(argv[i], "weak") == 0) weak = 1;
+        else {
+            //só um número puro vale como tile_steps; qualquer outra coisa é erro de digitação
+            char* end;
+            long value = strtol(argv[i], &end, 10);
+            if (end == argv[i] || *end != '\0' || value < 0) {
+                printf("Opção desconhecida: %s\n", argv[i]);
+                return 0;
+            }
+            tileSteps = value;
         }
+    }
+    if (weak) MESHROWS *= reqThreads;
+    if (MESHROWS < 3 || MESHCOLS < 3) {
+        printf("A malha precisa de pelo menos 3 x 3 pontos\n");
+        return 0;
+    }
+    INTERIOR_AVG = (NORTH_BOUND + SOUTH_BOUND + EAST_BOUND + WEST_BOUND) / 4.0;
+    meshBytes = (size_t)MESHROWS * MESHCOLS * sizeof(float);
+    if (tileSteps > MAX_TILE_STEPS) tileSteps = MAX_TILE_STEPS;
+    if (persistent && tileSteps > 1) {
+        printf("A blocagem temporal já usa uma região paralela por bloco; ignorando \"persistent\".\n");
+        persistent = 0;
+    }
+
+    //fixa as threads nos places pedidos (reinicia o programa se precisar mudar o ambiente do OpenMP)
+    pinThreads(argv, places, bind);
 
-        xFull[r * MESHSIZE + MESHSIZE - 1] = EAST_BOUND; //inicializa o valor do limite leste (ultima coluna)
-        xFull[r * MESHSIZE + 0] = WEST_BOUND;          //inicializa o valor do limite oeste (primeira coluna)
+    //Alocar memória para as matrizes
+    //malloc só reserva endereços: cada página vai para o nó NUMA da thread que escrever nela primeiro
+    xFull = (float*)malloc(meshBytes);
+    xNew = (float*)malloc(meshBytes);
+    if (tileSteps > 1) xSave = (float*)malloc(meshBytes);
+    if (xFull == NULL || xNew == NULL || (tileSteps > 1 && xSave == NULL)) {
+        printf("Memória insuficiente para uma malha %d x %d\n", MESHROWS, MESHCOLS);
+        return 0;
     }
-    for (c = 0; c < MESHSIZE; c++) {
-        xFull[0 * MESHSIZE + c] = NORTH_BOUND;   //inicializa o valor do limite norte (primeira linha (0))
-        xFull[(MESHSIZE - 1) * MESHSIZE + c] = SOUTH_BOUND;    //inicializa o valor do limite sul (ultima linha (MESHSIZE-1))
+
+    firstRow = (int*)malloc(reqThreads * sizeof(int));
+    lastRow = (int*)malloc(reqThreads * sizeof(int));
+    threadNode = (int*)malloc(reqThreads * sizeof(int));
+    for (i = 0; i < reqThreads; i++) {
+        firstRow[i] = MESHROWS;
+        lastRow[i] = -1;
+        threadNode[i] = -1;
     }
 
-    for (r = 0; r < MESHSIZE; r++) {  //copia os valores iniciais de xFull para xNew
-        for (c = 0; c < MESHSIZE; c++) {
-            xNew[r * MESHSIZE + c] = xFull[r * MESHSIZE + c];
+
+    /* Inicializando as matrizes */
+    //em paralelo e com o mesmo escalonamento estático das varreduras, para que cada thread
+    //seja a primeira a tocar (e portanto aloque no seu nó) as linhas que ela vai calcular
+#pragma omp parallel private(r,c) num_threads(reqThreads)
+    {
+        int t = omp_get_thread_num();
+        threadNode[t] = currentNode();
+
+#pragma omp for schedule(static)
+        for (r = 1; r < MESHROWS - 1; r++) { //preenche o interior e os limites leste e oeste
+            if (firstRow[t] > r) firstRow[t] = r;
+            lastRow[t] = r;
+
+            float* row = xFull + (size_t)r * MESHCOLS;
+
+            for (c = 0; c < MESHCOLS; c++) { //passa por todas as posições
+                row[c] = INTERIOR_AVG;    //preenche o interior com a média dos valores de limite
+            }
+
+            row[MESHCOLS - 1] = EAST_BOUND; //inicializa o valor do limite leste (ultima coluna)
+            row[0] = WEST_BOUND;          //inicializa o valor do limite oeste (primeira coluna)
+
+            //xNew (e a terceira malha do bloco temporal) começam com os mesmos valores
+            memcpy(xNew + (size_t)r * MESHCOLS, row, MESHCOLS * sizeof(float));
+            if (xSave != NULL) memcpy(xSave + (size_t)r * MESHCOLS, row, MESHCOLS * sizeof(float));
         }
     }
+    for (c = 0; c < MESHCOLS; c++) {
+        xFull[0 * MESHCOLS + c] = NORTH_BOUND;   //inicializa o valor do limite norte (primeira linha (0))
+        xFull[(size_t)(MESHROWS - 1) * MESHCOLS + c] = SOUTH_BOUND;    //inicializa o valor do limite sul (ultima linha (MESHROWS-1))
+        xNew[0 * MESHCOLS + c] = NORTH_BOUND;
+        xNew[(size_t)(MESHROWS - 1) * MESHCOLS + c] = SOUTH_BOUND;
+        if (xSave != NULL) {
+            xSave[0 * MESHCOLS + c] = NORTH_BOUND;
+            xSave[(size_t)(MESHROWS - 1) * MESHCOLS + c] = SOUTH_BOUND;
+        }
+    }
+
+    //relatório de onde as threads e as páginas ficaram
+    printf("OMP_PLACES=%s OMP_PROC_BIND=%s\n", getenv("OMP_PLACES") ? getenv("OMP_PLACES") : "(não definido)",
+           getenv("OMP_PROC_BIND") ? getenv("OMP_PROC_BIND") : "(não definido)");
+    for (i = 0; i < reqThreads; i++)
+        if (lastRow[i] >= 0)
+            printf("  thread %d: linhas %d-%d, nó %d\n", i, firstRow[i], lastRow[i], threadNode[i]);
+    placementReport(xFull, "xFull", firstRow, lastRow, threadNode, reqThreads, MESHROWS, MESHCOLS);
+    placementReport(xNew, "xNew", firstRow, lastRow, threadNode, reqThreads, MESHROWS, MESHCOLS);
 
 
+    //escolhe o kernel do estêncil (SSE2/AVX2/AVX-512) de acordo com a CPU
+    printf("Kernel do estêncil: %s\n", stencilInit());
+    printf("Malha: %d x %d%s, limites N %g S %g L %g O %g\n", MESHROWS, MESHCOLS, weak ? " (weak)" : "",
+           NORTH_BOUND, SOUTH_BOUND, EAST_BOUND, WEST_BOUND);
+
     start = omp_get_wtime(); //inicia o timer
 
     //loop principal de iteração
     itrCount = 0;   //zera o contador de iterações
 
-    do { //laço do...while para as iterações de Jacobi
+    if (persistent)
+        gDiffNorm = persistentSolve(&xFull, &xNew, epsilon, maxIterations, &itrCount, MESHROWS, MESHCOLS, reqThreads);
+    else do { //laço do...while para as iterações de Jacobi
 
-        itrCount++; //incrementa o contador de iterações
-        gDiffNorm = 0.0; //zera o gDiffNorm para a iteração atual
+        if (tileSteps > 1) {
+            //blocagem temporal: avança vários passos de uma vez dentro de faixas que cabem na cache
+            int steps = tileSteps;
+            int s;
+            if (steps > maxIterations - itrCount) steps = maxIterations - itrCount;
+            if (steps < 1) steps = 1;
 
+            //o bloco só lê xFull (no primeiro passo) e alterna entre xNew e xSave: a malha do
+            //início do bloco continua em xFull, sem cópia, caso seja preciso voltar a ela
+            tiledSweeps(xFull, xNew, xSave, steps, norms, MESHROWS, MESHCOLS, reqThreads);
 
-        //divide o trabalho entre as threads, cada thread calcula uma linha da matriz, cada thread tem sua própria cópia de r e c
-        //e o gDiffNorm é reduzido somando os valores de cada thread no final
-#pragma omp parallel for private(r,c) reduction(+:gDiffNorm) num_threads(reqThreads)
-            for (r = 1; r < MESHSIZE - 1; r++) //percorre todas as linhas, exceto os limites para manter as bordas fixas
-                for (c = 1; c < MESHSIZE - 1; c++) { //percorre todas as colunas, exceto os limites para manter as bordas fixas
-                    xNew[r * MESHSIZE + c] = (xFull[r * MESHSIZE + c + 1] + xFull[r * MESHSIZE + c - 1] +     //calcula o novo valor como a média dos 4 vizinhos
-                        xFull[(r + 1) * MESHSIZE + c] + xFull[(r - 1) * MESHSIZE + c]) / 4.0;
+            //procura o primeiro passo em que a varredura simples teria parado
+            for (s = 0; s < steps - 1; s++)
+                if (sqrt(norms[s]) <= epsilon) break;
 
-                    //armazena o quadrado da diferença entre o novo e o antigo valor para calcular o erro normalizado
-                    gDiffNorm += (xNew[r * MESHSIZE + c] - xFull[r * MESHSIZE + c]) *           
-                        (xNew[r * MESHSIZE + c] - xFull[r * MESHSIZE + c]);
+            if (s < steps - 1) {
+                //convergiu no meio do bloco: recomeça do início do bloco com a varredura simples
+                tileSteps = 0;
+            }
+            else {
+                //o resultado fica em xNew quando o número de passos é ímpar e em xSave quando é par
+                float* tmp = xFull;
+                if (steps % 2 == 1) {
+                    xFull = xNew;
+                    xNew = tmp;
                 }
-        
+                else {
+                    xFull = xSave;
+                    xSave = tmp;
+                }
+                itrCount += steps;
+                gDiffNorm = sqrt(norms[steps - 1]);
+                continue;
+            }
+        }
+
+        itrCount++; //incrementa o contador de iterações
+
+        gDiffNorm = sweep(xFull, xNew, MESHROWS, MESHCOLS, reqThreads);
 
         //uma vez que foi calculado o novo valor para cada célula, trocamos os ponteiros para que xFull aponte para a matriz com os novos valores
         float* tmp = xFull;
@@ -116,20 +258,251 @@ int main(int argc, char** argv){
     //libera a memória alocada
     free(xNew);
     free(xFull);
+    free(xSave);
+    free(firstRow);
+    free(lastRow);
+    free(threadNode);
 
     //printa que o codigo terminou normalmente
     printf("<normal termination>\n");
     return 0;
 }
 
+//uma iteração de Jacobi sobre a malha inteira; retorna a soma dos quadrados das diferenças
+float sweep(float* xFull, float* xNew, const int MESHROWS, const int MESHCOLS, int reqThreads) {
+    int r;
+    float gDiffNorm = 0.0;
+
+    //divide o trabalho entre as threads, cada thread calcula uma linha da matriz (com o kernel vetorial de stencil.c)
+    //e o gDiffNorm é reduzido somando os valores de cada thread no final
+    //o escalonamento estático é o mesmo da inicialização, então cada thread lê linhas que estão no seu nó
+#pragma omp parallel for private(r) reduction(+:gDiffNorm) schedule(static) num_threads(reqThreads)
+        for (r = 1; r < MESHROWS - 1; r++) //percorre todas as linhas, exceto os limites para manter as bordas fixas
+            gDiffNorm += stencilRows(xFull, xNew, r, r, 1, MESHCOLS);
+
+    return gDiffNorm;
+}
+
+//resolve tudo dentro de uma única região paralela (sem fork/join por iteração).
+//Cada thread fica com as mesmas linhas do schedule(static) de sweep() e guarda sua soma
+//num slot próprio, sem critical nem atomic. Há uma barreira por iteração: depois dela a
+//thread 0 soma os slots, tira a raiz e publica a decisão, que as outras só leem depois da
+//barreira seguinte. Enquanto isso todas já calcularam mais uma iteração por conta; ela
+//escreve no buffer da iteração anterior à que convergiu, então a resposta não muda e o
+//custo é uma varredura extra no final.
+//Os slots e a decisão são duplicados pela paridade da iteração para não serem sobrescritos
+//antes de serem lidos. Na volta, *xFull aponta para a malha final.
+float persistentSolve(float** xFull, float** xNew, float epsilon, int maxIterations, int* itrCount, const int MESHROWS, const int MESHCOLS, int reqThreads) {
+    float* slots = (float*)calloc(2 * reqThreads * NORM_PAD, sizeof(float));
+    float norms[2] = { 0.0, 0.0 };     //gDiffNorm das duas últimas iterações (pela paridade)
+    int stop[2] = { 0, 0 };            //decisão de parada das duas últimas iterações
+    float* result = *xFull;
+    float gDiffNorm = 0.0;
+
+#pragma omp parallel num_threads(reqThreads)
+    {
+        const int t = omp_get_thread_num();
+        const int nThreads = omp_get_num_threads();
+        const int interior = MESHROWS - 2;
+        const int chunk = interior / nThreads, extra = interior % nThreads;
+        const int rBegin = 1 + t * chunk + (t < extra ? t : extra);      //mesma divisão do schedule(static)
+        const int rEnd = rBegin + chunk + (t < extra ? 1 : 0) - 1;
+        float* src = *xFull;     //cada thread troca os próprios ponteiros
+        float* dst = *xNew;
+        int k, i;
+
+        for (k = 1; ; k++) {
+            const int par = k % 2;
+            float* tmp;
+
+            slots[(par * nThreads + t) * NORM_PAD] = (rEnd >= rBegin) ? stencilRows(src, dst, rBegin, rEnd, 1, MESHCOLS) : 0.0;
+            tmp = src;
+            src = dst;
+            dst = tmp;
+
+#pragma omp barrier
+
+            if (t == 0) {
+                float sum = 0.0;
+                for (i = 0; i < nThreads; i++) sum += slots[(par * nThreads + i) * NORM_PAD];
+                norms[par] = sqrt(sum);
+                stop[par] = norms[par] <= epsilon;
+            }
+
+            //a decisão da iteração anterior foi publicada antes desta barreira; a iteração k
+            //foi por conta e o resultado é o da k - 1, que está em dst
+            if (k > 1 && stop[1 - par]) {
+                if (t == 0) {
+                    *itrCount = k - 1;
+                    gDiffNorm = norms[1 - par];
+                    result = dst;
+                }
+                break;
+            }
+            //o limite de iterações todas conhecem, então saem juntas sem esperar a decisão
+            if (k >= maxIterations) {
+                if (t == 0) {
+                    *itrCount = k;
+                    gDiffNorm = norms[par];
+                    result = src;
+                }
+                break;
+            }
+        }
+    }
+
+    if (result != *xFull) {
+        *xNew = *xFull;
+        *xFull = result;
+    }
+    free(slots);
+    return gDiffNorm;
+}
+
+//avança "steps" iterações com blocagem temporal (time skewing por faixas de linhas).
+//A faixa que começa na linha r0 calcula, no passo s, as linhas [r0 - s, r0 - s + TILE_ROWS),
+//lendo do buffer s % 2 e escrevendo no buffer (s + 1) % 2, onde o buffer 0 é xFull no primeiro
+//passo e xSave nos demais e o buffer 1 é xNew. Como cada faixa recua uma linha
+//por passo, tudo que ela lê já foi calculado e nada que ainda será lido é sobrescrito, e a
+//faixa inteira continua na cache entre os passos. Cada ponto recebe exatamente a mesma conta
+//da varredura simples, então a malha resultante é idêntica bit a bit.
+//xFull só é lida, então continua com a malha do início do bloco; o resultado final fica em
+//xSave se steps for par e em xNew se for ímpar.
+//norms[s] recebe a soma dos quadrados das diferenças do passo s.
+void tiledSweeps(float* xFull, float* xNew, float* xSave, int steps, float* norms, const int MESHROWS, const int MESHCOLS, int reqThreads) {
+    float* buf[2] = { xSave, xNew };
+    const int LAST_ROW = MESHROWS - 2;     //última linha interior
+    int s;
+
+    for (s = 0; s < steps; s++) norms[s] = 0.0;
+
+#pragma omp parallel num_threads(reqThreads)
+    {
+        float myNorms[MAX_TILE_STEPS];     //parcela de cada passo calculada por esta thread
+        int r0, step, r;
+
+        for (step = 0; step < steps; step++) myNorms[step] = 0.0;
+
+        //a última faixa precisa cobrir a última linha interior também no último passo
+        for (r0 = 1; r0 - (steps - 1) <= LAST_ROW; r0 += TILE_ROWS) {
+            for (step = 0; step < steps; step++) {
+                int rBegin = r0 - step;
+                int rEnd = r0 - step + TILE_ROWS;    //exclusivo
+                float* src = (step == 0) ? xFull : buf[step % 2];
+                float* dst = buf[(step + 1) % 2];
+
+                if (rBegin < 1) rBegin = 1;
+                if (rEnd > LAST_ROW + 1) rEnd = LAST_ROW + 1;
+
+                //a barreira implícita do "for" garante que o passo anterior terminou
+#pragma omp for schedule(static)
+                for (r = rBegin; r < rEnd; r++)
+                    myNorms[step] += stencilRows(src, dst, r, r, 1, MESHCOLS);
+            }
+        }
+
+        for (step = 0; step < steps; step++) {
+#pragma omp atomic
+            norms[step] += myNorms[step];
+        }
+    }
+}
+
+//OMP_PLACES e OMP_PROC_BIND só são lidos quando o runtime do OpenMP carrega, então para
+//aplicar places=/bind= da linha de comando o programa se executa de novo com o ambiente ajustado
+void pinThreads(char** argv, const char* places, const char* bind) {
+    int changed = 0;
+
+    if (places != NULL && (getenv("OMP_PLACES") == NULL || strcmp(getenv("OMP_PLACES"), places) != 0)) {
+        setenv("OMP_PLACES", places, 1);
+        changed = 1;
+    }
+    if (places != NULL && bind == NULL) bind = "close";     //places sem bind não fixa nada
+    if (bind != NULL && (getenv("OMP_PROC_BIND") == NULL || strcmp(getenv("OMP_PROC_BIND"), bind) != 0)) {
+        setenv("OMP_PROC_BIND", bind, 1);
+        changed = 1;
+    }
+    if (!changed) return;
+
+    fflush(stdout);
+#ifdef __linux__
+    execv("/proc/self/exe", argv);
+#endif
+    execvp(argv[0], argv);
+    printf("Não foi possível reiniciar com OMP_PLACES/OMP_PROC_BIND; as threads não serão fixadas.\n");
+}
+
+//nó NUMA da CPU em que a thread está rodando agora (-1 se não der para saber)
+int currentNode(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) return (int)node;
+#endif
+    return -1;
+}
+
+//conta em que nó está cada página da malha (move_pages sem destino só consulta) e
+//quantas estão no mesmo nó da thread que calcula as linhas daquela página
+void placementReport(float* mesh, const char* name, int* firstRow, int* lastRow, int* threadNode, int nThreads, const int MESHROWS, const int MESHCOLS) {
+#if defined(__linux__) && defined(SYS_move_pages)
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    const size_t bytes = (size_t)MESHROWS * MESHCOLS * sizeof(float);
+    char* begin = (char*)((size_t)mesh & ~(size_t)(pageSize - 1));
+    unsigned long count = ((char*)mesh + bytes - begin + pageSize - 1) / pageSize;
+    void** pages = (void**)malloc(count * sizeof(void*));
+    int* status = (int*)malloc(count * sizeof(int));
+    int perNode[64] = { 0 };
+    long local = 0, owned = 0, missing = 0;
+    unsigned long p;
+    int t, node;
+
+    for (p = 0; p < count; p++) pages[p] = begin + p * pageSize;
+    if (syscall(SYS_move_pages, 0, count, pages, NULL, status, 0) != 0) {
+        printf("  %s: consulta das páginas indisponível\n", name);
+        free(pages);
+        free(status);
+        return;
+    }
+
+    for (p = 0; p < count; p++) {
+        if (status[p] < 0 || status[p] >= 64) {
+            missing++;
+            continue;
+        }
+        perNode[status[p]]++;
+
+        //linha do primeiro float da página e a thread dona dela
+        long offset = (char*)pages[p] - (char*)mesh;
+        int row = (offset < 0) ? 0 : (int)(offset / (MESHCOLS * sizeof(float)));
+        for (t = 0; t < nThreads; t++)
+            if (row >= firstRow[t] && row <= lastRow[t]) {
+                owned++;
+                if (threadNode[t] == status[p]) local++;
+                break;
+            }
+    }
+
+    printf("  %s: %lu páginas;", name, count);
+    for (node = 0; node < 64; node++)
+        if (perNode[node] > 0) printf(" nó %d: %d", node, perNode[node]);
+    if (missing > 0) printf(" sem nó: %ld", missing);
+    printf("; %.1f%% no nó da thread dona\n", owned > 0 ? 100.0 * local / owned : 0.0);
+
+    free(pages);
+    free(status);
+#else
+    printf("  %s: relatório de páginas só está disponível no Linux\n", name);
+#endif
+}
+
 //print contents of 2d array to console (for testing purposes)
-void printMesh(float* meshArray, const int MESHSIZE) {
+void printMesh(float* meshArray, const int MESHROWS, const int MESHCOLS) {
     int r, c;   //loop control variables
 
-    for (r = 0; r < MESHSIZE; r++) {
-        for (c = 0; c < MESHSIZE; c++) {
+    for (r = 0; r < MESHROWS; r++) {
+        for (c = 0; c < MESHCOLS; c++) {
             //print cell with width 5 and 1 digit after the decimal
-            printf("%5.1f ", meshArray[r * MESHSIZE + c]);
+            printf("%5.1f ", meshArray[(size_t)r * MESHCOLS + c]);
         }
         //print newline
         printf("\n");
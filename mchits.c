@@ -0,0 +1,229 @@
+/* Monte Carlo pi hit counting with run-time instruction set dispatch (see mchits.h)
+*
+*  Each coordinate keeps the top 26 bits of its Philox word as an integer
+*  valued double, so x*x + y*y < 2^53 is exact and the test against the
+*  (scaled) radius 2^52 gives the same answer in every variant, with or
+*  without fused multiply-adds. The vector variants keep one Philox block per
+*  32-bit lane and do the 32x32->64 multiplies with two mul_epu32 (even and
+*  odd lanes), blended back into high and low halves.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "mchits.h"
+#include "philox.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MCHITS_X86 1
+#endif
+
+#define MC_SHIFT 6                     //32 - 26 bits dropped from each word
+#define MC_RADIUS2 4503599627370496.0  //2^52: the unit circle in 26-bit coordinates
+
+typedef long (*HitsKernel)(uint64_t, uint64_t, uint64_t, long);
+
+static HitsKernel kernel = NULL;
+static long kernelBlocks = 1;   //blocks the kernel handles per step
+
+static inline int isHit(uint32_t a, uint32_t b) {
+    double x = a >> MC_SHIFT, y = b >> MC_SHIFT;
+    return x * x + y * y <= MC_RADIUS2;
+}
+
+//points first..last-1, one Philox block (two points) at a time
+static long hitsRange(uint64_t seed, uint64_t stream, long first, long last) {
+    uint32_t key[2] = { (uint32_t)seed, (uint32_t)(seed >> 32) };
+    long count = 0, p;
+
+    for (p = first & ~1L; p < last; p += 2) {
+        uint64_t block = p / 2;
+        uint32_t w[4] = { (uint32_t)block, (uint32_t)(block >> 32), (uint32_t)stream, (uint32_t)(stream >> 32) };
+
+        philox4x32(w, key);
+        if (p >= first) count += isHit(w[0], w[1]);
+        if (p + 1 < last) count += isHit(w[2], w[3]);
+    }
+    return count;
+}
+
+static long hitsScalar(uint64_t seed, uint64_t stream, uint64_t firstBlock, long blocks) {
+    return hitsRange(seed, stream, 2 * firstBlock, 2 * (firstBlock + blocks));
+}
+
+#ifdef MCHITS_X86
+
+//lo and *hi of the 64-bit products a * m in each 32-bit lane
+__attribute__((target("avx2")))
+static inline __m256i mulhilo8(__m256i a, __m256i m, __m256i* hi) {
+    __m256i even = _mm256_mul_epu32(a, m);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+
+    *hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+    return _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+}
+
+//hits among the 4 points with x coordinates in the lanes of x and y coordinates in those of y
+__attribute__((target("avx2")))
+static inline int hits4(__m128i x, __m128i y) {
+    __m256d dx = _mm256_cvtepi32_pd(_mm_srli_epi32(x, MC_SHIFT));
+    __m256d dy = _mm256_cvtepi32_pd(_mm_srli_epi32(y, MC_SHIFT));
+    __m256d d = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+
+    return __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(d, _mm256_set1_pd(MC_RADIUS2), _CMP_LE_OQ)));
+}
+
+//8 blocks (16 points) per step; blocks is a multiple of 8
+__attribute__((target("avx2")))
+static long hitsAVX2(uint64_t seed, uint64_t stream, uint64_t firstBlock, long blocks) {
+    long b, count = 0;
+    uint32_t lo[8], hi[8];
+    __m256i c0, c1, step = _mm256_set1_epi32(8), last = _mm256_set1_epi32(7);
+    __m256i s0 = _mm256_set1_epi32((uint32_t)stream), s1 = _mm256_set1_epi32((uint32_t)(stream >> 32));
+    __m256i m0 = _mm256_set1_epi32(PHILOX_M0), m1 = _mm256_set1_epi32(PHILOX_M1);
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        lo[i] = (uint32_t)(firstBlock + i);
+        hi[i] = (uint32_t)((firstBlock + i) >> 32);
+    }
+    c0 = _mm256_loadu_si256((const __m256i*)lo);
+    c1 = _mm256_loadu_si256((const __m256i*)hi);
+
+    for (b = 0; b < blocks; b += 8) {
+        __m256i x0 = c0, x1 = c1, x2 = s0, x3 = s1, h0, h1, l0, l1, wrapped;
+        uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+        int round;
+
+        for (round = 0; round < 10; round++) {
+            l0 = mulhilo8(x0, m0, &h0);
+            l1 = mulhilo8(x2, m1, &h1);
+            x0 = _mm256_xor_si256(_mm256_xor_si256(h1, x1), _mm256_set1_epi32(k0));
+            x1 = l1;
+            x2 = _mm256_xor_si256(_mm256_xor_si256(h0, x3), _mm256_set1_epi32(k1));
+            x3 = l0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+
+        count += hits4(_mm256_castsi256_si128(x0), _mm256_castsi256_si128(x1));
+        count += hits4(_mm256_extracti128_si256(x0, 1), _mm256_extracti128_si256(x1, 1));
+        count += hits4(_mm256_castsi256_si128(x2), _mm256_castsi256_si128(x3));
+        count += hits4(_mm256_extracti128_si256(x2, 1), _mm256_extracti128_si256(x3, 1));
+
+        //next 8 block numbers, carrying into the high word in the lanes that wrapped
+        c0 = _mm256_add_epi32(c0, step);
+        wrapped = _mm256_cmpeq_epi32(_mm256_min_epu32(c0, last), c0);
+        c1 = _mm256_sub_epi32(c1, wrapped);
+    }
+
+    return count;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i mulhilo16(__m512i a, __m512i m, __m512i* hi) {
+    __m512i even = _mm512_mul_epu32(a, m);
+    __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), m);
+
+    *hi = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even, 32), odd);
+    return _mm512_mask_blend_epi32(0xAAAA, even, _mm512_slli_epi64(odd, 32));
+}
+
+__attribute__((target("avx512f")))
+static inline int hits8(__m256i x, __m256i y) {
+    __m512d dx = _mm512_cvtepi32_pd(_mm256_srli_epi32(x, MC_SHIFT));
+    __m512d dy = _mm512_cvtepi32_pd(_mm256_srli_epi32(y, MC_SHIFT));
+    __m512d d = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+
+    return __builtin_popcount(_mm512_cmp_pd_mask(d, _mm512_set1_pd(MC_RADIUS2), _CMP_LE_OQ));
+}
+
+//16 blocks (32 points) per step; blocks is a multiple of 16
+__attribute__((target("avx512f")))
+static long hitsAVX512(uint64_t seed, uint64_t stream, uint64_t firstBlock, long blocks) {
+    long b, count = 0;
+    uint32_t lo[16], hi[16];
+    __m512i c0, c1, step = _mm512_set1_epi32(16), one = _mm512_set1_epi32(1);
+    __m512i s0 = _mm512_set1_epi32((uint32_t)stream), s1 = _mm512_set1_epi32((uint32_t)(stream >> 32));
+    __m512i m0 = _mm512_set1_epi32(PHILOX_M0), m1 = _mm512_set1_epi32(PHILOX_M1);
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        lo[i] = (uint32_t)(firstBlock + i);
+        hi[i] = (uint32_t)((firstBlock + i) >> 32);
+    }
+    c0 = _mm512_loadu_si512(lo);
+    c1 = _mm512_loadu_si512(hi);
+
+    for (b = 0; b < blocks; b += 16) {
+        __m512i x0 = c0, x1 = c1, x2 = s0, x3 = s1, h0, h1, l0, l1;
+        uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+        int round;
+
+        for (round = 0; round < 10; round++) {
+            l0 = mulhilo16(x0, m0, &h0);
+            l1 = mulhilo16(x2, m1, &h1);
+            x0 = _mm512_xor_si512(_mm512_xor_si512(h1, x1), _mm512_set1_epi32(k0));
+            x1 = l1;
+            x2 = _mm512_xor_si512(_mm512_xor_si512(h0, x3), _mm512_set1_epi32(k1));
+            x3 = l0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+
+        count += hits8(_mm512_castsi512_si256(x0), _mm512_castsi512_si256(x1));
+        count += hits8(_mm512_extracti64x4_epi64(x0, 1), _mm512_extracti64x4_epi64(x1, 1));
+        count += hits8(_mm512_castsi512_si256(x2), _mm512_castsi512_si256(x3));
+        count += hits8(_mm512_extracti64x4_epi64(x2, 1), _mm512_extracti64x4_epi64(x3, 1));
+
+        c0 = _mm512_add_epi32(c0, step);
+        c1 = _mm512_mask_add_epi32(c1, _mm512_cmplt_epu32_mask(c0, step), c1, one);
+    }
+
+    return count;
+}
+
+#endif
+
+const char* mcInit(void) {
+    const char* forced = getenv("MC_ISA");
+
+    kernel = hitsScalar;
+    kernelBlocks = 1;
+    if (forced != NULL && strcmp(forced, "scalar") == 0) return "scalar";
+
+#ifdef MCHITS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && (forced == NULL || strcmp(forced, "avx512") == 0)) {
+        kernel = hitsAVX512;
+        kernelBlocks = 16;
+        return "avx512";
+    }
+    if (__builtin_cpu_supports("avx2") && (forced == NULL || strcmp(forced, "avx512") == 0 || strcmp(forced, "avx2") == 0)) {
+        kernel = hitsAVX2;
+        kernelBlocks = 8;
+        return "avx2";
+    }
+#endif
+
+    return "scalar";
+}
+
+long mcHits(uint64_t seed, uint64_t stream, long points) {
+    return mcHitsRange(seed, stream, 0, points);
+}
+
+long mcHitsRange(uint64_t seed, uint64_t stream, long first, long last) {
+    long firstBlock, blocks;
+
+    if (kernel == NULL) mcInit();
+    if (last <= first) return 0;
+
+    //whole steps of the kernel go through it, the points around them through hitsRange
+    firstBlock = (first + 1) / 2;
+    blocks = (last / 2 - firstBlock) / kernelBlocks * kernelBlocks;
+    if (blocks <= 0) return hitsRange(seed, stream, first, last);
+    return hitsRange(seed, stream, first, 2 * firstBlock) +
+           kernel(seed, stream, firstBlock, blocks) +
+           hitsRange(seed, stream, 2 * (firstBlock + blocks), last);
+}
@@ -0,0 +1,34 @@
+/* Monte Carlo pi hit counter shared by "Monte Carlo MPI/mpiMCpi.c" and
+*  "Monte Carlo MPI/MCpi_sequencial.c".
+*
+*  Point p of a stream is made of Philox words 2*(p%2) and 2*(p%2)+1 of block
+*  p/2 (philox4x32 in philox.h). Each coordinate is the top 26 bits of its word,
+*  an integer 0..2^26-1 (not the [0, 1) doubles of philoxUniform), and the point
+*  is a hit when x*x + y*y <= 2^52, i.e. inside the circle at that scale. The
+*  sum is below 2^53, so it is exact in a double and no rounding or fused
+*  multiply-add can change a test. The AVX2 and AVX-512 variants run 8 or 16
+*  Philox blocks at once in vector registers and count hits with compare masks
+*  and popcount; since every test is exact they return exactly the same count
+*  as the scalar loop. mcInit() picks the widest one the CPU supports at run time.
+*
+*  Build together with the program, e.g. mpicc mpiMCpi.c ../mchits.c -o mpiMCpi
+*/
+
+#ifndef MCHITS_H
+#define MCHITS_H
+
+#include <stdint.h>
+
+//choose the kernel for this CPU and return its name ("avx512", "avx2" or "scalar")
+//setting MC_ISA to one of those names forces a narrower kernel (handy for comparisons)
+//call it once, before any thread uses mcHits
+const char* mcInit(void);
+
+//number of points 0..points-1 of stream "stream" under "seed" that fall inside the unit circle
+long mcHits(uint64_t seed, uint64_t stream, long points);
+
+//the same for points first..last-1 only, so a stream can be split between threads or ranks:
+//the counts of consecutive ranges add up to the count of the whole range
+long mcHitsRange(uint64_t seed, uint64_t stream, long first, long last);
+
+#endif
@@ -3,29 +3,33 @@
 #include <math.h>
 #include <time.h>
 #include "mpi.h"
+#include "philox.h"
+
+#define SEED 314159
 
 int main(int argc, char* argv[])
 {
 	long int niter = 100000000000000;
 	int myid;						//hold's process's rank id
 	double x,y;						//x,y value for the random coordinate
-	int i;
-        int count=0;						//Count holds all the number of how many good coordinates
+	double u[4];						//two random points per Philox call
+	long int i;
+        long int count=0;						//Count holds all the number of how many good coordinates
 	double z;						//Used to check if x^2+y^2<=1
 	double pi;						//holds approx value of pi
 	int numnodes;
-	int reducedcount;					//total number of "good" points from all nodes
+	long int reducedcount;					//total number of "good" points from all nodes
 
 	MPI_Init(&argc, &argv);					//Start MPI
 	MPI_Comm_rank(MPI_COMM_WORLD, &myid);			//get rank of node's process
 	MPI_Comm_size(MPI_COMM_WORLD, &numnodes);
 
-	srand48(time(NULL)+myid);
-
 	for(i = 0; i < niter; i++)
 	{
-		x = (double)drand48();			//gets a random x coordinate
-		y = (double)drand48();			//gets a random y coordinate
+		if (i % 2 == 0)				//one Philox block holds two points of this rank's stream
+			philoxUniform(SEED, myid, i / 2, u);
+		x = u[2*(i%2)];				//gets a random x coordinate
+		y = u[2*(i%2)+1];			//gets a random y coordinate
 		z = ((x*x)+(y*y));			//Checks to see if number in inside unit circle
 		if (z<=1)
 		{
@@ -35,9 +39,9 @@ int main(int argc, char* argv[])
 
 	/* Now we can reduce the values to master */
 
-	MPI_Reduce(&count, &reducedcount, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	MPI_Reduce(&count, &reducedcount, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
 		
-	int total_iter = niter * numnodes;
+	long int total_iter = niter * numnodes;
 
 	if (myid == 0)						//if root process
 	{      
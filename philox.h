@@ -0,0 +1,57 @@
+/* Counter-based random numbers for the Monte Carlo pi programs.
+*
+*  Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3",
+*  SC 2011) turns a 128-bit counter and a 64-bit key into 128 random bits with
+*  ten rounds of multiplies and xors. There is no state: the same counter and
+*  key always give the same numbers, so any thread or rank can produce any part
+*  of a stream without locks, seeding or skipping ahead. Each call gives four
+*  32-bit words, e.g. two points of a Monte Carlo run.
+*
+*  The programs key the generator with a fixed seed and put the task (or point)
+*  number in the counter, so a task's points do not depend on which worker ran
+*  it or on how many ranks there were.
+*
+*  Header only; include it and call philoxUniform (or philox4x32 for raw words).
+*/
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <stdint.h>
+
+#define PHILOX_M0 0xD2511F53u     //round multipliers
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u     //key schedule (golden ratio and sqrt(3) - 1)
+#define PHILOX_W1 0xBB67AE85u
+
+//replace ctr with the 4 random words of block (ctr, key)
+static inline void philox4x32(uint32_t ctr[4], const uint32_t key[2]) {
+    uint32_t k0 = key[0], k1 = key[1];
+    int round;
+
+    for (round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * ctr[0];
+        uint64_t p1 = (uint64_t)PHILOX_M1 * ctr[2];
+        uint32_t c1 = ctr[1], c3 = ctr[3];
+
+        ctr[0] = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        ctr[1] = (uint32_t)p1;
+        ctr[2] = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        ctr[3] = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+}
+
+//4 uniform doubles in [0, 1), 32 random bits each, for block "index" of stream "stream"
+//under "seed". Streams and blocks are independent 64-bit numbers (e.g. task id and point / 2).
+static inline void philoxUniform(uint64_t seed, uint64_t stream, uint64_t index, double out[4]) {
+    uint32_t key[2] = { (uint32_t)seed, (uint32_t)(seed >> 32) };
+    uint32_t ctr[4] = { (uint32_t)index, (uint32_t)(index >> 32), (uint32_t)stream, (uint32_t)(stream >> 32) };
+    int i;
+
+    philox4x32(ctr, key);
+    for (i = 0; i < 4; i++) out[i] = ctr[i] * (1.0 / 4294967296.0);
+}
+
+#endif
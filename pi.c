@@ -1,13 +1,15 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include "philox.h"
+
+#define SEED 314159
 
 int main(int argc, char* argv[]) {
     int rank, size;
     long long int total_points = 1000000;
     long long int local_points, local_hits = 0, total_hits = 0;
-    double x, y;
+    double u[4];
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -32,10 +34,13 @@ int main(int argc, char* argv[]) {
         // Slaves
         MPI_Recv(&local_points, 1, MPI_LONG_LONG_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
-        srand(time(NULL) + rank);
+        // cada slave pega a sua faixa de uma única sequência Philox (contador = índice global
+        // do ponto), então os pontos sorteados não dependem de quantos processos rodam
+        long long int first = (rank - 1) * local_points;
         for (long long int i = 0; i < local_points; i++) {
-            x = (double)rand() / RAND_MAX;
-            y = (double)rand() / RAND_MAX;
+            long long int p = first + i;
+            if (p % 2 == 0 || i == 0) philoxUniform(SEED, 0, p / 2, u);   // 2 pontos por chamada
+            double x = u[2 * (p % 2)], y = u[2 * (p % 2) + 1];
             if (x * x + y * y <= 1.0) local_hits++;
         }
 
@@ -0,0 +1,345 @@
+/* Jacobi stencil kernels with run-time instruction set dispatch (see stencil.h)
+*
+*  new = (east + west + south + north) * 0.25 is evaluated in that order in
+*  every variant, which matches the scalar "(...) / 4.0" bit for bit. The
+*  norm is kept in two vector accumulators so the adds do not wait on each
+*  other, and the new value is reused from the register instead of being
+*  reloaded from xNew.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "stencil.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STENCIL_X86 1
+#endif
+
+typedef float (*StencilKernel)(const float*, float*, int, int, int, int);
+typedef float (*StencilKernel16)(const uint16_t*, uint16_t*, int, int, int, int, int);
+
+static StencilKernel kernel = NULL;
+static StencilKernel16 kernel16 = NULL;
+
+//float <-> bf16: keep the top half of the float, rounding the dropped half to nearest even
+static uint16_t floatToBF16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, 4);
+    if ((x & 0x7FFFFFFF) > 0x7F800000) return (x >> 16) | 0x40;     //keep NaN a NaN
+    return (x + 0x7FFF + ((x >> 16) & 1)) >> 16;
+}
+
+static float bf16ToFloat(uint16_t h) {
+    uint32_t x = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &x, 4);
+    return f;
+}
+
+//float <-> IEEE half, round to nearest even, with subnormals, overflow to infinity and NaN
+static uint16_t floatToHalf(float f) {
+    uint32_t x, absx, sign;
+    memcpy(&x, &f, 4);
+    sign = (x >> 16) & 0x8000;
+    absx = x & 0x7FFFFFFF;
+
+    if (absx >= 0x7F800000) return sign | 0x7C00 | (absx > 0x7F800000 ? 0x200 : 0);
+    if (absx >= 0x477FF000) return sign | 0x7C00;     //65520 and up round to infinity
+    if (absx < 0x38800000) {                          //below 2^-14: half subnormal (or zero)
+        int shift;
+        uint32_t full, m, rem, halfway;
+
+        if (absx < 0x33000000) return sign;           //below 2^-25 rounds to zero
+        shift = 126 - (int)(absx >> 23);
+        full = (absx & 0x7FFFFF) | 0x800000;
+        m = full >> shift;
+        rem = full & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (m & 1))) m++;
+        return sign | m;
+    }
+
+    //rebias the exponent (127 -> 15) and round the 13 dropped bits
+    absx -= 0x38000000;
+    return sign | ((absx + 0xFFF + ((absx >> 13) & 1)) >> 13);
+}
+
+static float halfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1F, mantissa = h & 0x3FF, x;
+    float f;
+
+    if (exponent == 0) {
+        f = mantissa * (1.0f / 16777216.0f);          //subnormal: mantissa * 2^-24
+        return sign ? -f : f;
+    }
+    if (exponent == 31) x = sign | 0x7F800000 | (mantissa << 13);
+    else x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    memcpy(&f, &x, 4);
+    return f;
+}
+
+static uint16_t toStorage(float f, int format) {
+    return (format == STENCIL_BF16) ? floatToBF16(f) : floatToHalf(f);
+}
+
+static float fromStorage(uint16_t h, int format) {
+    return (format == STENCIL_BF16) ? bf16ToFloat(h) : halfToFloat(h);
+}
+
+//plain C version; also finishes the columns left over by the vector loops
+static float rowTail(const float* xOld, float* xNew, int r, int c, int width, int withNorm, float norm) {
+    for (; c < width - 1; c++) {
+        float v = (xOld[(long)r * width + c + 1] + xOld[(long)r * width + c - 1] +
+                   xOld[(long)(r + 1) * width + c] + xOld[(long)(r - 1) * width + c]) * 0.25f;
+        float d = v - xOld[(long)r * width + c];
+
+        xNew[(long)r * width + c] = v;
+        if (withNorm) norm += d * d;
+    }
+    return norm;
+}
+
+static float stencilScalar(const float* xOld, float* xNew, int rBegin, int rEnd, int withNorm, int width) {
+    float norm = 0.0f;
+    int r;
+
+    for (r = rBegin; r <= rEnd; r++)
+        norm = rowTail(xOld, xNew, r, 1, width, withNorm, norm);
+    return norm;
+}
+
+//16-bit version of rowTail
+static float rowTail16(const uint16_t* xOld, uint16_t* xNew, int r, int c, int width, int withNorm, float norm, int format) {
+    for (; c < width - 1; c++) {
+        float v = (fromStorage(xOld[(long)r * width + c + 1], format) + fromStorage(xOld[(long)r * width + c - 1], format) +
+                   fromStorage(xOld[(long)(r + 1) * width + c], format) + fromStorage(xOld[(long)(r - 1) * width + c], format)) * 0.25f;
+        uint16_t stored = toStorage(v, format);
+        float d = fromStorage(stored, format) - fromStorage(xOld[(long)r * width + c], format);
+
+        xNew[(long)r * width + c] = stored;
+        if (withNorm) norm += d * d;
+    }
+    return norm;
+}
+
+static float stencilScalar16(const uint16_t* xOld, uint16_t* xNew, int rBegin, int rEnd, int withNorm, int width, int format) {
+    float norm = 0.0f;
+    int r;
+
+    for (r = rBegin; r <= rEnd; r++)
+        norm = rowTail16(xOld, xNew, r, 1, width, withNorm, norm, format);
+    return norm;
+}
+
+#ifdef STENCIL_X86
+
+__attribute__((target("sse2")))
+static float stencilSSE2(const float* xOld, float* xNew, int rBegin, int rEnd, int withNorm, int width) {
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    float norm = 0.0f, lanes[4];
+    int r, c;
+
+    for (r = rBegin; r <= rEnd; r++) {
+        const float* row = xOld + (long)r * width;
+        float* out = xNew + (long)r * width;
+
+        for (c = 1; c + 8 <= width - 1; c += 8) {
+            __m128 v0 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(
+                            _mm_loadu_ps(row + c + 1), _mm_loadu_ps(row + c - 1)),
+                            _mm_loadu_ps(row + width + c)), _mm_loadu_ps(row - width + c)), quarter);
+            __m128 v1 = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(
+                            _mm_loadu_ps(row + c + 5), _mm_loadu_ps(row + c + 3)),
+                            _mm_loadu_ps(row + width + c + 4)), _mm_loadu_ps(row - width + c + 4)), quarter);
+
+            _mm_storeu_ps(out + c, v0);
+            _mm_storeu_ps(out + c + 4, v1);
+            if (withNorm) {
+                __m128 d0 = _mm_sub_ps(v0, _mm_loadu_ps(row + c));
+                __m128 d1 = _mm_sub_ps(v1, _mm_loadu_ps(row + c + 4));
+                acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+                acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+            }
+        }
+        norm = rowTail(xOld, xNew, r, c, width, withNorm, norm);
+    }
+
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    return norm + lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+static float stencilAVX2(const float* xOld, float* xNew, int rBegin, int rEnd, int withNorm, int width) {
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    float norm = 0.0f, lanes[8];
+    int r, c, i;
+
+    for (r = rBegin; r <= rEnd; r++) {
+        const float* row = xOld + (long)r * width;
+        float* out = xNew + (long)r * width;
+
+        for (c = 1; c + 16 <= width - 1; c += 16) {
+            __m256 v0 = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                            _mm256_loadu_ps(row + c + 1), _mm256_loadu_ps(row + c - 1)),
+                            _mm256_loadu_ps(row + width + c)), _mm256_loadu_ps(row - width + c)), quarter);
+            __m256 v1 = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                            _mm256_loadu_ps(row + c + 9), _mm256_loadu_ps(row + c + 7)),
+                            _mm256_loadu_ps(row + width + c + 8)), _mm256_loadu_ps(row - width + c + 8)), quarter);
+
+            _mm256_storeu_ps(out + c, v0);
+            _mm256_storeu_ps(out + c + 8, v1);
+            if (withNorm) {
+                __m256 d0 = _mm256_sub_ps(v0, _mm256_loadu_ps(row + c));
+                __m256 d1 = _mm256_sub_ps(v1, _mm256_loadu_ps(row + c + 8));
+                acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(d0, d0));
+                acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(d1, d1));
+            }
+        }
+        norm = rowTail(xOld, xNew, r, c, width, withNorm, norm);
+    }
+
+    _mm256_storeu_ps(lanes, _mm256_add_ps(acc0, acc1));
+    for (i = 0; i < 8; i++) norm += lanes[i];
+    return norm;
+}
+
+__attribute__((target("avx512f")))
+static float stencilAVX512(const float* xOld, float* xNew, int rBegin, int rEnd, int withNorm, int width) {
+    const __m512 quarter = _mm512_set1_ps(0.25f);
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    float norm = 0.0f;
+    int r, c;
+
+    for (r = rBegin; r <= rEnd; r++) {
+        const float* row = xOld + (long)r * width;
+        float* out = xNew + (long)r * width;
+
+        for (c = 1; c + 32 <= width - 1; c += 32) {
+            __m512 v0 = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_add_ps(
+                            _mm512_loadu_ps(row + c + 1), _mm512_loadu_ps(row + c - 1)),
+                            _mm512_loadu_ps(row + width + c)), _mm512_loadu_ps(row - width + c)), quarter);
+            __m512 v1 = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_add_ps(
+                            _mm512_loadu_ps(row + c + 17), _mm512_loadu_ps(row + c + 15)),
+                            _mm512_loadu_ps(row + width + c + 16)), _mm512_loadu_ps(row - width + c + 16)), quarter);
+
+            _mm512_storeu_ps(out + c, v0);
+            _mm512_storeu_ps(out + c + 16, v1);
+            if (withNorm) {
+                __m512 d0 = _mm512_sub_ps(v0, _mm512_loadu_ps(row + c));
+                __m512 d1 = _mm512_sub_ps(v1, _mm512_loadu_ps(row + c + 16));
+                acc0 = _mm512_add_ps(acc0, _mm512_mul_ps(d0, d0));
+                acc1 = _mm512_add_ps(acc1, _mm512_mul_ps(d1, d1));
+            }
+        }
+        norm = rowTail(xOld, xNew, r, c, width, withNorm, norm);
+    }
+
+    return norm + _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+//8 stored values widened to float
+__attribute__((target("avx2,f16c")))
+static inline __m256 load16(const uint16_t* p, int format) {
+    __m128i h = _mm_loadu_si128((const __m128i*)p);
+    if (format == STENCIL_BF16)
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+    return _mm256_cvtph_ps(h);
+}
+
+//8 floats rounded to the storage format (nearest even, like the scalar code)
+__attribute__((target("avx2,f16c")))
+static inline __m128i round16(__m256 v, int format) {
+    if (format == STENCIL_BF16) {
+        __m256i x = _mm256_castps_si256(v);
+        __m256i odd = _mm256_and_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(1));
+        x = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(x, _mm256_set1_epi32(0x7FFF)), odd), 16);
+        x = _mm256_permute4x64_epi64(_mm256_packus_epi32(x, x), 0xD8);
+        return _mm256_castsi256_si128(x);
+    }
+    return _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT);
+}
+
+__attribute__((target("avx2,f16c")))
+static float stencilAVX2_16(const uint16_t* xOld, uint16_t* xNew, int rBegin, int rEnd, int withNorm, int width, int format) {
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    __m256 acc = _mm256_setzero_ps();
+    float norm = 0.0f, lanes[8];
+    int r, c, i;
+
+    for (r = rBegin; r <= rEnd; r++) {
+        const uint16_t* row = xOld + (long)r * width;
+        uint16_t* out = xNew + (long)r * width;
+
+        for (c = 1; c + 8 <= width - 1; c += 8) {
+            __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                           load16(row + c + 1, format), load16(row + c - 1, format)),
+                           load16(row + width + c, format)), load16(row - width + c, format)), quarter);
+            __m128i stored = round16(v, format);
+
+            _mm_storeu_si128((__m128i*)(out + c), stored);
+            if (withNorm) {
+                __m256 d = _mm256_sub_ps(load16(out + c, format), load16(row + c, format));
+                acc = _mm256_add_ps(acc, _mm256_mul_ps(d, d));
+            }
+        }
+        norm = rowTail16(xOld, xNew, r, c, width, withNorm, norm, format);
+    }
+
+    _mm256_storeu_ps(lanes, acc);
+    for (i = 0; i < 8; i++) norm += lanes[i];
+    return norm;
+}
+
+#endif
+
+const char* stencilInit(void) {
+    const char* forced = getenv("STENCIL_ISA");
+
+    kernel = stencilScalar;
+    kernel16 = stencilScalar16;
+    if (forced != NULL && strcmp(forced, "scalar") == 0) return "scalar";
+
+#ifdef STENCIL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c") &&
+        (forced == NULL || strcmp(forced, "avx512") == 0 || strcmp(forced, "avx2") == 0))
+        kernel16 = stencilAVX2_16;
+    if (__builtin_cpu_supports("avx512f") && (forced == NULL || strcmp(forced, "avx512") == 0)) {
+        kernel = stencilAVX512;
+        return "avx512";
+    }
+    if (__builtin_cpu_supports("avx2") && (forced == NULL || strcmp(forced, "avx512") == 0 || strcmp(forced, "avx2") == 0)) {
+        kernel = stencilAVX2;
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        kernel = stencilSSE2;
+        return "sse2";
+    }
+#endif
+
+    return "scalar";
+}
+
+float stencilRows(const float* xOld, float* xNew, int rBegin, int rEnd, int withNorm, int width) {
+    if (kernel == NULL) stencilInit();
+    return kernel(xOld, xNew, rBegin, rEnd, withNorm, width);
+}
+
+void stencilPack(const float* in, uint16_t* out, long n, int format) {
+    long i;
+    for (i = 0; i < n; i++) out[i] = toStorage(in[i], format);
+}
+
+void stencilUnpack(const uint16_t* in, float* out, long n, int format) {
+    long i;
+    for (i = 0; i < n; i++) out[i] = fromStorage(in[i], format);
+}
+
+float stencilRows16(const uint16_t* xOld, uint16_t* xNew, int rBegin, int rEnd, int withNorm, int width, int format) {
+    if (kernel16 == NULL) stencilInit();
+    return kernel16(xOld, xNew, rBegin, rEnd, withNorm, width, format);
+}
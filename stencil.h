@@ -0,0 +1,45 @@
+/* Shared 4-point Jacobi stencil kernel used by jacobi.c, jacobi_omp.c and
+*  t4/jacobi_fases_paralelas.c.
+*
+*  The SSE2, AVX2 and AVX-512 variants are all built into stencil.c, so no
+*  per-node flags are needed; stencilInit() picks the widest one the CPU
+*  supports at run time. Every variant gives the same mesh values as the
+*  original scalar loop (same additions in the same order, and /4 is exact);
+*  only the order in which diffNorm is summed changes.
+*
+*  Build together with the solver, e.g. mpicc jacobi.c stencil.c -o jacobi -lm
+*
+*  The 16-bit variants keep the mesh as bf16 or fp16 in memory and only widen
+*  it to float inside the kernel. Conversions are done in software (or with
+*  F16C/AVX2 when present, which round the same way), so no fp16 arithmetic
+*  support is needed.
+*/
+
+#ifndef STENCIL_H
+#define STENCIL_H
+
+#include <stdint.h>
+
+//16-bit storage formats
+#define STENCIL_BF16 1    //bfloat16: float exponent, 8 bit significand
+#define STENCIL_FP16 2    //IEEE half: 5 bit exponent, 11 bit significand
+
+//choose the kernel for this CPU and return its name ("avx512", "avx2", "sse2" or "scalar")
+//setting STENCIL_ISA to one of those names forces a narrower kernel (handy for comparisons)
+//call it once, before any thread uses stencilRows
+const char* stencilInit(void);
+
+//compute the new values of rows rBegin..rEnd (inclusive), columns 1..width-2, of a mesh
+//stored row by row with width floats per row; returns the sum of the squared differences
+//(0 when withNorm is not set, and then the sum is skipped entirely)
+float stencilRows(const float* xOld, float* xNew, int rBegin, int rEnd, int withNorm, int width);
+
+//convert n values between float and a 16-bit format (round to nearest even)
+void stencilPack(const float* in, uint16_t* out, long n, int format);
+void stencilUnpack(const uint16_t* in, float* out, long n, int format);
+
+//stencilRows on a mesh stored in a 16-bit format: the average is computed in float and
+//rounded to the format; the norm sums, in float, the squared change of the stored values
+float stencilRows16(const uint16_t* xOld, uint16_t* xNew, int rBegin, int rEnd, int withNorm, int width, int format);
+
+#endif
@@ -2,7 +2,9 @@
 #include <stdlib.h>
 #include <time.h>
 //#define DEBUG 0            // comentar esta linha quando for medir tempo
+#ifndef ARRAY_SIZE             // pode ser trocado na compilação: -DARRAY_SIZE=100000
 #define ARRAY_SIZE 1000000    // trabalho final com o valores 10.000, 100.000, 1.000.000
+#endif
 extern double get_time(void);
 void bs(int n, int * vetor)
 {
@@ -25,11 +27,17 @@ void bs(int n, int * vetor)
 
 int main()
 {
-    int vetor[ARRAY_SIZE];
+    static int vetor[ARRAY_SIZE];    // fora da pilha, para tamanhos grandes
     int i;
 
+#ifdef RANDOM_INPUT                            // -DRANDOM_INPUT: mesmo vetor do bubble_balanceado.c
+    srand (314159);
+    for (i=0 ; i<ARRAY_SIZE; i++)
+        vetor[i] = rand () % ARRAY_SIZE;
+#else
     for (i=0 ; i<ARRAY_SIZE; i++)              /* init array with worst case for sorting */
         vetor[i] = ARRAY_SIZE-i;
+#endif
    
 
     #ifdef DEBUG
@@ -1,58 +1,177 @@
+// mpicc jacobi_fases_paralelas.c ../stencil.c ../timing.c -o jacobi_fases -lm -pthread
+// snapshots comprimidos (zlib): acrescentar -DSNAPSHOT_ZLIB -lz
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef SNAPSHOT_ZLIB
+#include <zlib.h>
+#endif
 #include "mpi.h"
+#include "../stencil.h"
+#include "../timing.h"
+
+#define SNAP_QUEUE 4    // snapshots que podem esperar pela thread de escrita antes de o solver parar
+
+// Um snapshot deste processo: as suas linhas da imagem reduzida, copiadas do xLocal
+typedef struct {
+    float* points;      // linhas amostradas x colunas amostradas
+    int    iteration;
+} Snapshot;
+
+// Escritor de snapshots em segundo plano (uma thread por processo, que não chama MPI).
+// O solver só copia os pontos amostrados para a fila; a thread converte para pixels
+// e grava a sua parte de cada arquivo com pwrite, enquanto as iterações continuam.
+typedef struct {
+    Snapshot        queue[SNAP_QUEUE];
+    int             head, count, done;     // fila circular; done encerra a thread
+    int             stride;                // pega uma linha/coluna a cada stride
+    int             cols, imageRows;       // tamanho da imagem reduzida
+    int             firstSample, rows;     // primeira linha da imagem que é deste processo, e quantas
+    int             localFirst;            // linha local (1..CHUNKROWS) da primeira linha amostrada
+    int             rank;                  // o rank 0 grava também o cabeçalho
+    int             written;
+    double          waited;                // tempo que o solver esperou por espaço na fila
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+} SnapshotWriter;
 
 float lerp(float from, float to, float t);
-void writeToPPM(float* mesh, int iterations, const int MESHSIZE);
-int getChunkRows(int rank, int commSize, const int MESHSIZE);
-int getChunkSize(int rank, int commSize, const int MESHSIZE);
+void writePPM(float* chunk, MPI_Offset meshOffset, long points, int iterations, const int MESHROWS, const int MESHCOLS);
+void writeRaw(float* chunk, MPI_Offset meshOffset, long points, int iterations, const int MESHROWS, const int MESHCOLS);
+int getChunkRows(int rank, int commSize, const int MESHROWS);
+long getChunkSize(int rank, int commSize, const int MESHROWS, const int MESHCOLS);
+void snapshotStart(SnapshotWriter* w, int firstRow, int chunkRows, int stride, int rank, const int MESHROWS, const int MESHCOLS);
+void snapshotPush(SnapshotWriter* w, float* xLocal, int iteration, const int MESHCOLS);
+void snapshotStop(SnapshotWriter* w);
+void* snapshotThread(void* arg);
 
 int main(int argc, char **argv)
 {
-    const int MESHSIZE = 1000;
-    const float NORTH_BOUND = 100.0;
-    const float SOUTH_BOUND = 100.0;
-    const float EAST_BOUND  = 0.0;
-    const float WEST_BOUND  = 0.0;
-    const float INTERIOR_AVG =
-        (NORTH_BOUND + SOUTH_BOUND + EAST_BOUND + WEST_BOUND) / 4.0;
+    // Tamanho e limites da malha; size=, bounds= e weak mudam na execução
+    int MESHROWS = 1000;     // linhas (divididas entre os processos)
+    int MESHCOLS = 1000;     // colunas
+    float NORTH_BOUND = 100.0;
+    float SOUTH_BOUND = 100.0;
+    float EAST_BOUND  = 0.0;
+    float WEST_BOUND  = 0.0;
+    float INTERIOR_AVG;
+
+    // weak: MESHROWS vira o número de linhas por processo e a malha cresce com os processos,
+    // como as tarefas do mpiMCpi em modo weak
+    int weak = 0;
 
     int rank, commSize, r, c, itrCount;
     int rFirst, rLast;
     MPI_Status status;
     float diffNorm, gDiffNorm;
-    float *xLocal, *xNew, *xFull;
+    float *xLocal, *xNew;
+    int outputPPM = 1, outputRaw = 0;   // arquivos de saída escritos ao final
 
     float epsilon;
     int maxIterations;
     double start, stop;
 
-    MPI_Init(&argc, &argv);
+    // Política de convergência: verifica a cada checkEvery iterações e,
+    // com "lagged", usa MPI_Iallreduce e só testa o resultado na iteração seguinte
+    int checkEvery = 1, lagged = 0;
+    int localOk = 0, prontoRec = 0;
+    MPI_Request checkRequest = MPI_REQUEST_NULL;
+
+    // Tempo de cada fase neste processo (sempre medido, custa uma chamada a MPI_Wtime por fase);
+    // com timing=csv|json o resumo de todos os processos é gravado no final
+    double phaseTime[PHASE_COUNT] = { 0.0 }, mark;
+    const char* timingFormat = NULL;
+
+    // Snapshots durante a solução: a cada snapshotEvery iterações (0 = nenhum), reduzidos
+    // por snapshotStride em cada direção, gravados por uma thread sem parar o solver
+    int snapshotEvery = 0, snapshotStride = 1, provided;
+    SnapshotWriter snapshots;
+
+    // só a thread principal chama MPI; a thread de snapshots apenas grava arquivos
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &commSize);
 
-    const int CHUNKROWS = getChunkRows(rank, commSize, MESHSIZE);
-    const int CHUNKSIZE = getChunkSize(rank, commSize, MESHSIZE);
-
     if (argc < 3) {
         if (rank == 0) {
-            printf("Uso: mpirun -np <N> ./jacobi [epsilon] [max_iterations]\n");
+            printf("Uso: mpirun -np <N> ./jacobi [epsilon] [max_iterations] [check=K] [lagged] [output=ppm|raw|all|none] [timing=csv|json]\n");
+            printf("       [snapshot=N] [snapshot_stride=S] [size=linhas[xcolunas]] [bounds=n,s,e,w] [weak]\n");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    for (int i = 3; i < argc; i++) {
+        if (strncmp(argv[i], "check=", 6) == 0 && strtol(argv[i] + 6, NULL, 10) > 0) {
+            checkEvery = strtol(argv[i] + 6, NULL, 10);
+        } else if (strcmp(argv[i], "lagged") == 0) {
+            lagged = 1;
+        } else if (strcmp(argv[i], "output=ppm") == 0 || strcmp(argv[i], "output=raw") == 0 ||
+                   strcmp(argv[i], "output=all") == 0 || strcmp(argv[i], "output=none") == 0) {
+            outputPPM = strcmp(argv[i] + 7, "ppm") == 0 || strcmp(argv[i] + 7, "all") == 0;
+            outputRaw = strcmp(argv[i] + 7, "raw") == 0 || strcmp(argv[i] + 7, "all") == 0;
+        } else if (strcmp(argv[i], "timing=csv") == 0 || strcmp(argv[i], "timing=json") == 0) {
+            timingFormat = argv[i] + 7;
+        } else if (strncmp(argv[i], "size=", 5) == 0 && sscanf(argv[i] + 5, "%d", &MESHROWS) == 1) {
+            // um número só mantém a malha quadrada
+            if (sscanf(argv[i] + 5, "%*dx%d", &MESHCOLS) != 1) MESHCOLS = MESHROWS;
+        } else if (strncmp(argv[i], "bounds=", 7) == 0 &&
+                   sscanf(argv[i] + 7, "%f,%f,%f,%f", &NORTH_BOUND, &SOUTH_BOUND, &EAST_BOUND, &WEST_BOUND) == 4) {
+        } else if (strcmp(argv[i], "weak") == 0) {
+            weak = 1;
+        } else if (strncmp(argv[i], "snapshot=", 9) == 0) {
+            snapshotEvery = strtol(argv[i] + 9, NULL, 10);
+        } else if (strncmp(argv[i], "snapshot_stride=", 16) == 0 && strtol(argv[i] + 16, NULL, 10) > 0) {
+            snapshotStride = strtol(argv[i] + 16, NULL, 10);
+        } else {
+            if (rank == 0) printf("Opção desconhecida: %s\n", argv[i]);
+            MPI_Finalize();
+            return 0;
         }
+    }
+
+    // a thread de snapshots não chama MPI, mas o MPI precisa aceitar outras threads no processo
+    if (snapshotEvery > 0 && provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) printf("Esta biblioteca MPI não suporta MPI_THREAD_FUNNELED; snapshot=N indisponível\n");
         MPI_Finalize();
         return 0;
     }
 
-    xLocal = (float*)malloc((CHUNKROWS + 2) * MESHSIZE * sizeof(float));
-    xNew   = (float*)malloc((CHUNKROWS + 2) * MESHSIZE * sizeof(float));
-    if (rank == 0) xFull = (float*)malloc(MESHSIZE * MESHSIZE * sizeof(float));
+    if (weak) MESHROWS *= commSize;
+    INTERIOR_AVG = (NORTH_BOUND + SOUTH_BOUND + EAST_BOUND + WEST_BOUND) / 4.0;
+
+    // cada processo precisa de uma linha, e as contagens do MPI são int (o pedaço em bytes de PPM < 2^31)
+    if (MESHROWS < 3 || MESHCOLS < 3 || MESHROWS < commSize ||
+        (long)getChunkRows(0, commSize, MESHROWS) * MESHCOLS * 3 > INT_MAX) {
+        if (rank == 0) printf("Não é possível dividir uma malha %d x %d entre %d processos\n", MESHROWS, MESHCOLS, commSize);
+        MPI_Finalize();
+        return 0;
+    }
+
+    const int CHUNKROWS = getChunkRows(rank, commSize, MESHROWS);
+    const long CHUNKSIZE = getChunkSize(rank, commSize, MESHROWS, MESHCOLS);
+
+    xLocal = (float*)malloc((size_t)(CHUNKROWS + 2) * MESHCOLS * sizeof(float));
+    xNew   = (float*)malloc((size_t)(CHUNKROWS + 2) * MESHCOLS * sizeof(float));
 
     epsilon = strtod(argv[1], NULL);
     maxIterations = strtol(argv[2], NULL, 10);
 
     if (rank == 0)
-        printf("Jacobi (MPI) - Modelo de Fases Paralelas com Alltoall\n");
+        printf("Jacobi (MPI) - Modelo de Fases Paralelas com Allreduce\n");
+
+    // escolhe o kernel do estêncil de acordo com a CPU
+    const char* isa = stencilInit();
+    if (rank == 0) printf("Kernel do estêncil: %s\n", isa);
+    if (rank == 0) printf("Malha: %d x %d%s, limites N %g S %g L %g O %g\n", MESHROWS, MESHCOLS, weak ? " (weak)" : "",
+                          NORTH_BOUND, SOUTH_BOUND, EAST_BOUND, WEST_BOUND);
 
     // === GERAÇÃO LOCAL (cada processo cria sua parte) ===
     rFirst = 1;
@@ -61,105 +180,141 @@ int main(int argc, char **argv)
     if (rank == commSize - 1) rLast--;
 
     for (r = 1; r <= CHUNKROWS; r++) {
-        for (c = 0; c < MESHSIZE; c++) {
-            xLocal[r * MESHSIZE + c] = INTERIOR_AVG;
+        for (c = 0; c < MESHCOLS; c++) {
+            xLocal[r * MESHCOLS + c] = INTERIOR_AVG;
         }
-        xLocal[r * MESHSIZE + MESHSIZE - 1] = EAST_BOUND;
-        xLocal[r * MESHSIZE + 0] = WEST_BOUND;
+        xLocal[r * MESHCOLS + MESHCOLS - 1] = EAST_BOUND;
+        xLocal[r * MESHCOLS + 0] = WEST_BOUND;
     }
 
-    for (c = 0; c < MESHSIZE; c++) {
-        xLocal[(rFirst - 1) * MESHSIZE + c] = NORTH_BOUND;
-        xLocal[(rLast + 1) * MESHSIZE + c]  = SOUTH_BOUND;
+    for (c = 0; c < MESHCOLS; c++) {
+        xLocal[(rFirst - 1) * MESHCOLS + c] = NORTH_BOUND;
+        xLocal[(rLast + 1) * MESHCOLS + c]  = SOUTH_BOUND;
     }
 
-    memcpy(xNew, xLocal, (CHUNKROWS + 2) * MESHSIZE * sizeof(float));
+    memcpy(xNew, xLocal, (size_t)(CHUNKROWS + 2) * MESHCOLS * sizeof(float));
+
+    if (snapshotEvery > 0) {
+        int firstRow = 0;
+        for (int proc = 0; proc < rank; proc++)
+            firstRow += getChunkRows(proc, commSize, MESHROWS);
+        snapshotStart(&snapshots, firstRow, CHUNKROWS, snapshotStride, rank, MESHROWS, MESHCOLS);
+#ifdef SNAPSHOT_ZLIB
+        if (rank == 0)
+            printf("Snapshots a cada %d iterações, imagem %dx%d (zcat jacobi_snap_<iteração>.*.ppm.gz > imagem.ppm)\n",
+                   snapshotEvery, snapshots.imageRows, snapshots.cols);
+#else
+        if (rank == 0)
+            printf("Snapshots a cada %d iterações, imagem %dx%d (jacobi_snap_<iteração>.ppm)\n",
+                   snapshotEvery, snapshots.imageRows, snapshots.cols);
+#endif
+    }
 
     if (rank == 0) start = MPI_Wtime();
 
     itrCount = 0;
     int pronto = 0;
+    gDiffNorm = 0.0;
+    mark = MPI_Wtime();
 
     // === LOOP PRINCIPAL EM FASES ===
     while (!pronto && itrCount < maxIterations) {
         itrCount++;
 
         // ---- FASE 1: PROCESSAMENTO LOCAL ----
-        diffNorm = 0.0;
-        for (r = rFirst; r <= rLast; r++) {
-            for (c = 1; c < MESHSIZE - 1; c++) {
-                xNew[r * MESHSIZE + c] = (
-                    xLocal[r * MESHSIZE + c + 1] +
-                    xLocal[r * MESHSIZE + c - 1] +
-                    xLocal[(r + 1) * MESHSIZE + c] +
-                    xLocal[(r - 1) * MESHSIZE + c]) / 4.0;
-                diffNorm += (xNew[r * MESHSIZE + c] - xLocal[r * MESHSIZE + c]) *
-                            (xNew[r * MESHSIZE + c] - xLocal[r * MESHSIZE + c]);
-            }
-        }
+        // A norma só é acumulada nas iterações em que haverá verificação
+        int checkNow = (itrCount % checkEvery == 0);
+        diffNorm = stencilRows(xLocal, xNew, rFirst, rLast, checkNow, MESHCOLS);
+        mark = phaseMark(phaseTime, PHASE_STENCIL, mark);
 
         // ---- FASE 2: VERIFICAÇÃO GLOBAL DE CONVERGÊNCIA ----
-        // Cada processo calcula seu próprio diffNorm
-        gDiffNorm = sqrt(diffNorm);
-        int local_ok = (gDiffNorm < epsilon) ? 1 : 0;
-
-        // Cada processo compartilha seu estado com todos (Alltoall)
-        int *estados_env = (int*)malloc(commSize * sizeof(int));
-        int *estados_rec = (int*)malloc(commSize * sizeof(int));
-        for (int i = 0; i < commSize; i++) estados_env[i] = local_ok;
-        MPI_Alltoall(estados_env, 1, MPI_INT, estados_rec, 1, MPI_INT, MPI_COMM_WORLD);
-
-        // Cada processo avalia se todos estão prontos
-        pronto = 1;
-        for (int i = 0; i < commSize; i++) {
-            if (estados_rec[i] == 0) pronto = 0;
+        // Cada processo calcula seu próprio diffNorm; todos estão prontos quando
+        // o AND lógico dos estados locais é 1 (um único Allreduce, sem buffers)
+        if (lagged) {
+            // termina a verificação postada antes; ela correu junto com a Fase 1 desta iteração
+            if (checkRequest != MPI_REQUEST_NULL) {
+                MPI_Wait(&checkRequest, MPI_STATUS_IGNORE);
+                pronto = prontoRec;
+            }
+            if (checkNow && !pronto) {
+                gDiffNorm = sqrt(diffNorm);
+                localOk = (gDiffNorm < epsilon) ? 1 : 0;
+                MPI_Iallreduce(&localOk, &prontoRec, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD, &checkRequest);
+            }
+        } else if (checkNow) {
+            gDiffNorm = sqrt(diffNorm);
+            localOk = (gDiffNorm < epsilon) ? 1 : 0;
+            MPI_Allreduce(&localOk, &pronto, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
         }
-        free(estados_env);
-        free(estados_rec);
 
         if (rank == 0 && itrCount % 500 == 0)
             printf("[Iter %d] Local diff = %e | Pronto = %d\n", itrCount, gDiffNorm, pronto);
+        mark = phaseMark(phaseTime, PHASE_REDUCE, mark);
 
         if (pronto) break;
 
         // ---- FASE 3: TROCA DE VALORES COM VIZINHOS ----
         if (rank < commSize - 1)
-            MPI_Send(xNew + (CHUNKROWS * MESHSIZE), MESHSIZE, MPI_FLOAT, rank + 1, 0, MPI_COMM_WORLD);
+            MPI_Send(xNew + (CHUNKROWS * MESHCOLS), MESHCOLS, MPI_FLOAT, rank + 1, 0, MPI_COMM_WORLD);
         if (rank > 0)
-            MPI_Recv(xNew, MESHSIZE, MPI_FLOAT, rank - 1, 0, MPI_COMM_WORLD, &status);
+            MPI_Recv(xNew, MESHCOLS, MPI_FLOAT, rank - 1, 0, MPI_COMM_WORLD, &status);
 
         if (rank > 0)
-            MPI_Send(xNew + (1 * MESHSIZE), MESHSIZE, MPI_FLOAT, rank - 1, 1, MPI_COMM_WORLD);
+            MPI_Send(xNew + (1 * MESHCOLS), MESHCOLS, MPI_FLOAT, rank - 1, 1, MPI_COMM_WORLD);
         if (rank < commSize - 1)
-            MPI_Recv(xNew + ((CHUNKROWS + 1) * MESHSIZE), MESHSIZE, MPI_FLOAT, rank + 1, 1, MPI_COMM_WORLD, &status);
+            MPI_Recv(xNew + ((CHUNKROWS + 1) * MESHCOLS), MESHCOLS, MPI_FLOAT, rank + 1, 1, MPI_COMM_WORLD, &status);
+        mark = phaseMark(phaseTime, PHASE_HALO, mark);
 
         // Troca de ponteiros
         float* tmp = xLocal;
         xLocal = xNew;
         xNew = tmp;
+
+        // ---- SNAPSHOT: só a cópia para a fila; a gravação fica com a thread ----
+        if (snapshotEvery > 0 && itrCount % snapshotEvery == 0) {
+            snapshotPush(&snapshots, xLocal, itrCount, MESHCOLS);
+            mark = phaseMark(phaseTime, PHASE_OUTPUT, mark);
+        }
     }
 
-    // === FASE FINAL: COLETA E SAÍDA ===
+    // uma verificação pode ficar pendente quando o limite de iterações encerra o laço
+    if (checkRequest != MPI_REQUEST_NULL) MPI_Wait(&checkRequest, MPI_STATUS_IGNORE);
+    mark = phaseMark(phaseTime, PHASE_REDUCE, mark);
+
+    // === FASE FINAL: SAÍDA ===
     if (rank == 0) {
-        memcpy(xFull, xLocal + (1 * MESHSIZE), CHUNKSIZE * sizeof(float));
+        stop = MPI_Wtime();
+        printf("\nConvergência atingida em %d iterações (%f s)\n", itrCount, stop - start);
+    }
 
-        int pointerOffset = 0;
-        for (int proc = 1; proc < commSize; proc++) {
-            pointerOffset += getChunkSize(proc - 1, commSize, MESHSIZE);
-            MPI_Recv(xFull + pointerOffset, getChunkSize(proc, commSize, MESHSIZE),
-                     MPI_FLOAT, proc, 0, MPI_COMM_WORLD, &status);
-        }
+    // espera a thread esvaziar a fila; o tempo conta como saída
+    if (snapshotEvery > 0) {
+        snapshotStop(&snapshots);
+        mark = phaseMark(phaseTime, PHASE_OUTPUT, mark);
+        if (rank == 0)
+            printf("Snapshots: %d gravados, solver esperou %f s pela fila (rank 0)\n", snapshots.written, snapshots.waited);
+    }
+
+    // Cada processo escreve o seu pedaço direto no arquivo (MPI-IO coletivo), sem coleta no rank 0
+    if (outputPPM || outputRaw) {
+        MPI_Offset meshOffset = 0;
+        for (int proc = 0; proc < rank; proc++)
+            meshOffset += getChunkSize(proc, commSize, MESHROWS, MESHCOLS);
 
+        start = MPI_Wtime();
+        if (outputPPM) writePPM(xLocal + (1 * MESHCOLS), meshOffset, CHUNKSIZE, itrCount, MESHROWS, MESHCOLS);
+        if (outputRaw) writeRaw(xLocal + (1 * MESHCOLS), meshOffset, CHUNKSIZE, itrCount, MESHROWS, MESHCOLS);
         stop = MPI_Wtime();
-        printf("\nConvergência atingida em %d iterações (%f s)\n", itrCount, stop - start);
-        writeToPPM(xFull, itrCount, MESHSIZE);
-    } else {
-        MPI_Send(xLocal + (1 * MESHSIZE), CHUNKSIZE, MPI_FLOAT, 0, 0, MPI_COMM_WORLD);
+        phaseTime[PHASE_OUTPUT] += stop - start;
+
+        if (rank == 0) printf("Saída escrita em %f s\n", stop - start);
     }
 
+    if (timingFormat) timingReport(phaseTime, itrCount, timingFormat,
+                                   strcmp(timingFormat, "json") == 0 ? "jacobi_fases_timing.json" : "jacobi_fases_timing.csv");
+
     free(xLocal);
     free(xNew);
-    if (rank == 0) free(xFull);
 
     if (rank == 0) printf("<normal termination>\n");
     MPI_Finalize();
@@ -167,34 +322,204 @@ int main(int argc, char **argv)
 }
 
 // === Funções auxiliares (sem alterações estruturais) ===
-void writeToPPM(float* mesh, int iterations, const int MESHSIZE) {
-    FILE* fp = fopen("jacobi.ppm", "w");
-    fprintf(fp, "P3 %d %d 255\n", MESHSIZE, MESHSIZE);
-    fprintf(fp, "# Jacobi MPI (Fases Paralelas com Alltoall)\n");
-    fprintf(fp, "# Iterações: %d\n", iterations);
-
-    for (int r = 0; r < MESHSIZE; r++) {
-        for (int c = 0; c < MESHSIZE; c++) {
-            float temp = mesh[r * MESHSIZE + c];
-            int red = lerp(0.0, 255.0, temp);
-            int blue = lerp(255.0, 0.0, temp);
-            fprintf(fp, "%d 0 %d ", red, blue);
+// PPM binário (P6): cada processo converte e escreve os seus pontos na posição certa do arquivo
+void writePPM(float* chunk, MPI_Offset meshOffset, long points, int iterations, const int MESHROWS, const int MESHCOLS) {
+    MPI_File fh;
+    char header[128];
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // todos montam o mesmo cabeçalho, assim sabem onde começam os pixels
+    int headerLen = snprintf(header, sizeof(header),
+        "P6\n# Jacobi MPI (Fases Paralelas com Allreduce)\n# Iterações: %d\n%d %d\n255\n",
+        iterations, MESHCOLS, MESHROWS);
+
+    unsigned char* pixels = (unsigned char*)malloc(points * 3);
+    for (long i = 0; i < points; i++) {
+        pixels[3 * i + 0] = lerp(0.0, 255.0, chunk[i]);
+        pixels[3 * i + 1] = 0;
+        pixels[3 * i + 2] = lerp(255.0, 0.0, chunk[i]);
+    }
+
+    MPI_File_open(MPI_COMM_WORLD, "jacobi.ppm", MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_File_set_size(fh, 0);
+    if (rank == 0) MPI_File_write_at(fh, 0, header, headerLen, MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(fh, headerLen + meshOffset * 3, pixels, points * 3, MPI_UNSIGNED_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    free(pixels);
+}
+
+// float32 bruto (ordem de bytes nativa) com cabeçalho texto de 64 bytes:
+// "JACOBI float32 <linhas> <colunas> <iterações>" completado com espaços e '\n'
+void writeRaw(float* chunk, MPI_Offset meshOffset, long points, int iterations, const int MESHROWS, const int MESHCOLS) {
+    MPI_File fh;
+    char header[64];
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    memset(header, ' ', sizeof(header));
+    memcpy(header, "JACOBI float32", 14);
+    header[snprintf(header + 14, sizeof(header) - 15, " %d %d %d", MESHROWS, MESHCOLS, iterations) + 14] = ' ';
+    header[sizeof(header) - 1] = '\n';
+
+    MPI_File_open(MPI_COMM_WORLD, "jacobi.raw", MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_File_set_size(fh, 0);
+    if (rank == 0) MPI_File_write_at(fh, 0, header, sizeof(header), MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(fh, sizeof(header) + meshOffset * sizeof(float), chunk, points, MPI_FLOAT, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+}
+
+// Prepara a fila e inicia a thread de escrita. A imagem reduzida tem as linhas e colunas
+// globais múltiplas de stride; firstRow é a linha global da primeira linha deste processo.
+void snapshotStart(SnapshotWriter* w, int firstRow, int chunkRows, int stride, int rank, const int MESHROWS, const int MESHCOLS) {
+    int firstSampled = (firstRow + stride - 1) / stride * stride;     // primeira linha global amostrada deste processo
+    int lastRow = firstRow + chunkRows - 1;
+
+    w->stride = stride;
+    w->cols = (MESHCOLS - 1) / stride + 1;
+    w->imageRows = (MESHROWS - 1) / stride + 1;
+    w->firstSample = firstSampled / stride;
+    w->rows = (firstSampled <= lastRow) ? (lastRow - firstSampled) / stride + 1 : 0;
+    w->localFirst = firstSampled - firstRow + 1;
+    w->rank = rank;
+    w->head = w->count = w->done = w->written = 0;
+    w->waited = 0.0;
+
+    for (int i = 0; i < SNAP_QUEUE; i++)
+        w->queue[i].points = (float*)malloc(((size_t)w->rows * w->cols + 1) * sizeof(float));
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->changed, NULL);
+    pthread_create(&w->thread, NULL, snapshotThread, w);
+}
+
+// Copia os pontos amostrados do xLocal para a fila e volta para o solver.
+// Só espera quando a fila está cheia, isto é, quando o disco não acompanha o ritmo dos snapshots.
+void snapshotPush(SnapshotWriter* w, float* xLocal, int iteration, const int MESHCOLS) {
+    double t = MPI_Wtime();
+
+    pthread_mutex_lock(&w->lock);
+    while (w->count == SNAP_QUEUE)
+        pthread_cond_wait(&w->changed, &w->lock);
+    Snapshot* snap = &w->queue[(w->head + w->count) % SNAP_QUEUE];
+    pthread_mutex_unlock(&w->lock);
+    w->waited += MPI_Wtime() - t;
+
+    // a posição está livre e só volta a ser usada depois de entrar na fila
+    for (int r = 0; r < w->rows; r++) {
+        float* row = xLocal + (size_t)(w->localFirst + r * w->stride) * MESHCOLS;
+        for (int c = 0; c < w->cols; c++)
+            snap->points[(size_t)r * w->cols + c] = row[c * w->stride];
+    }
+    snap->iteration = iteration;
+
+    pthread_mutex_lock(&w->lock);
+    w->count++;
+    pthread_cond_signal(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Espera a thread gravar o que ainda está na fila e libera tudo
+void snapshotStop(SnapshotWriter* w) {
+    pthread_mutex_lock(&w->lock);
+    w->done = 1;
+    pthread_cond_signal(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->changed);
+    for (int i = 0; i < SNAP_QUEUE; i++)
+        free(w->queue[i].points);
+}
+
+// Thread de escrita: converte cada snapshot para pixels RGB (3 bytes por ponto contra 4 de um
+// float) e grava a parte deste processo com pwrite na posição certa; o rank 0 grava também o
+// cabeçalho. Os processos escrevem regiões disjuntas, então o arquivo não precisa de MPI-IO nem
+// de barreira.
+// Com -DSNAPSHOT_ZLIB a parte é comprimida (gzip nível 1) num arquivo por processo,
+// jacobi_snap_<iteração>.<rank>.ppm.gz: o tamanho comprimido não é conhecido de antemão, e
+// combinar as posições num arquivo só exigiria MPI nesta thread. Membros gzip concatenados
+// formam um gzip válido, então zcat das partes em ordem de rank devolve o PPM inteiro.
+void* snapshotThread(void* arg) {
+    SnapshotWriter* w = (SnapshotWriter*)arg;
+    unsigned char* pixels = (unsigned char*)malloc((size_t)w->rows * w->cols * 3 + 1);
+    char header[128], fileName[64];
+
+    while (1) {
+        pthread_mutex_lock(&w->lock);
+        while (w->count == 0 && !w->done)
+            pthread_cond_wait(&w->changed, &w->lock);
+        if (w->count == 0) {
+            pthread_mutex_unlock(&w->lock);
+            break;
         }
-        fprintf(fp, "\n");
+        Snapshot* snap = &w->queue[w->head];
+        pthread_mutex_unlock(&w->lock);
+
+        size_t points = (size_t)w->rows * w->cols;
+        for (size_t i = 0; i < points; i++) {
+            pixels[3 * i + 0] = lerp(0.0, 255.0, snap->points[i]);
+            pixels[3 * i + 1] = 0;
+            pixels[3 * i + 2] = lerp(255.0, 0.0, snap->points[i]);
+        }
+
+        // todos montam o mesmo cabeçalho, assim sabem onde começam os pixels
+        int headerLen = snprintf(header, sizeof(header), "P6\n# Jacobi MPI (snapshot)\n# Iterações: %d\n%d %d\n255\n",
+                                 snap->iteration, w->cols, w->imageRows);
+#ifdef SNAPSHOT_ZLIB
+        snprintf(fileName, sizeof(fileName), "jacobi_snap_%06d.%03d.ppm.gz", snap->iteration, w->rank);
+
+        gzFile gz = gzopen(fileName, "wb1");
+        if (gz == NULL) {
+            printf("Não foi possível abrir %s\n", fileName);
+        } else {
+            if ((w->rank == 0 && gzwrite(gz, header, headerLen) != headerLen) ||
+                (points > 0 && gzwrite(gz, pixels, points * 3) != (int)(points * 3)))
+                printf("Erro ao gravar %s\n", fileName);
+            if (gzclose(gz) != Z_OK)
+                printf("Erro ao gravar %s\n", fileName);
+        }
+#else
+        snprintf(fileName, sizeof(fileName), "jacobi_snap_%06d.ppm", snap->iteration);
+
+        int fd = open(fileName, O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) {
+            printf("Não foi possível abrir %s\n", fileName);
+        } else {
+            off_t offset = headerLen + (off_t)w->firstSample * w->cols * 3;
+            // todos cortam no mesmo tamanho final, o que descarta sobras de um arquivo antigo maior
+            if (ftruncate(fd, headerLen + (off_t)w->imageRows * w->cols * 3) != 0 ||
+                (w->rank == 0 && pwrite(fd, header, headerLen, 0) != headerLen) ||
+                pwrite(fd, pixels, points * 3, offset) != (ssize_t)(points * 3))
+                printf("Erro ao gravar %s\n", fileName);
+            close(fd);
+        }
+#endif
+
+        pthread_mutex_lock(&w->lock);
+        w->head = (w->head + 1) % SNAP_QUEUE;
+        w->count--;
+        w->written++;
+        pthread_cond_signal(&w->changed);
+        pthread_mutex_unlock(&w->lock);
     }
-    fclose(fp);
+
+    free(pixels);
+    return NULL;
 }
 
 float lerp(float from, float to, float t) {
     return from + (t / 100.0f) * (to - from);
 }
 
-int getChunkRows(int rank, int commSize, const int MESHSIZE) {
-    int chunkRows = MESHSIZE / commSize;
-    int remainder = MESHSIZE % commSize;
+int getChunkRows(int rank, int commSize, const int MESHROWS) {
+    int chunkRows = MESHROWS / commSize;
+    int remainder = MESHROWS % commSize;
     return (rank < remainder) ? chunkRows + 1 : chunkRows;
 }
 
-int getChunkSize(int rank, int commSize, const int MESHSIZE) {
-    return getChunkRows(rank, commSize, MESHSIZE) * MESHSIZE;
+long getChunkSize(int rank, int commSize, const int MESHROWS, const int MESHCOLS) {
+    return (long)getChunkRows(rank, commSize, MESHROWS) * MESHCOLS;
 }
@@ -0,0 +1,77 @@
+/* Phase timing report for the MPI Jacobi solvers (see timing.h) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "timing.h"
+
+static const char* phaseNames[PHASE_COUNT] = { "stencil", "halo", "reduction", "checkpoint", "rebalance", "output" };
+
+void timingReport(const double* phaseTime, int iterations, const char* format, const char* fileName) {
+    int rank, commSize, p, r;
+    double* all = NULL;     //all[r * PHASE_COUNT + p] is phase p of rank r
+    FILE* fp;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &commSize);
+
+    if (rank == 0) all = (double*)malloc(commSize * PHASE_COUNT * sizeof(double));
+    MPI_Gather((void*)phaseTime, PHASE_COUNT, MPI_DOUBLE, all, PHASE_COUNT, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (rank != 0) return;
+
+    int json = strcmp(format, "json") == 0;
+    fp = fopen(fileName, "w");
+    if (fp == NULL) {
+        printf("Could not open %s for the timing report\n", fileName);
+        free(all);
+        return;
+    }
+
+    if (json) {
+        fprintf(fp, "{\n  \"ranks\": %d,\n  \"iterations\": %d,\n  \"phases\": {\n", commSize, iterations);
+    }
+    else {
+        fprintf(fp, "phase,ranks,iterations,min_s,avg_s,max_s,imbalance,max_rank");
+        for (r = 0; r < commSize; r++) fprintf(fp, ",rank_%d", r);
+        fprintf(fp, "\n");
+    }
+
+    printf("Phase timing (seconds, over %d ranks):\n", commSize);
+    for (p = 0; p < PHASE_COUNT; p++) {
+        double min = all[p], max = all[p], sum = 0.0;
+        int maxRank = 0;
+
+        for (r = 0; r < commSize; r++) {
+            double t = all[r * PHASE_COUNT + p];
+            sum += t;
+            if (t < min) min = t;
+            if (t > max) {
+                max = t;
+                maxRank = r;
+            }
+        }
+        double avg = sum / commSize;
+        double imbalance = (avg > 0.0) ? max / avg : 1.0;     //1.0 means perfectly balanced
+
+        if (max > 0.0)
+            printf("  %-10s min %9.6f  avg %9.6f  max %9.6f  imbalance %5.2f (rank %d)\n",
+                   phaseNames[p], min, avg, max, imbalance, maxRank);
+
+        if (json) {
+            fprintf(fp, "    \"%s\": { \"min\": %.9f, \"avg\": %.9f, \"max\": %.9f, \"imbalance\": %.6f, \"max_rank\": %d, \"per_rank\": [",
+                    phaseNames[p], min, avg, max, imbalance, maxRank);
+            for (r = 0; r < commSize; r++) fprintf(fp, "%s%.9f", r ? ", " : "", all[r * PHASE_COUNT + p]);
+            fprintf(fp, "] }%s\n", p < PHASE_COUNT - 1 ? "," : "");
+        }
+        else {
+            fprintf(fp, "%s,%d,%d,%.9f,%.9f,%.9f,%.6f,%d", phaseNames[p], commSize, iterations, min, avg, max, imbalance, maxRank);
+            for (r = 0; r < commSize; r++) fprintf(fp, ",%.9f", all[r * PHASE_COUNT + p]);
+            fprintf(fp, "\n");
+        }
+    }
+    if (json) fprintf(fp, "  }\n}\n");
+
+    fclose(fp);
+    printf("Phase timing written to %s\n", fileName);
+    free(all);
+}
@@ -0,0 +1,41 @@
+/* Per-phase timers for the MPI Jacobi solvers (jacobi.c and
+*  t4/jacobi_fases_paralelas.c).
+*
+*  Each rank keeps one running total per phase. A phase is closed with
+*  phaseMark(), which costs one MPI_Wtime call, so the timers can stay on in
+*  production runs. At the end timingReport() gathers the totals and the
+*  master writes min/avg/max per phase, the imbalance (max / avg) and the
+*  value of every rank as CSV or JSON.
+*
+*  Build together with the solver, e.g. mpicc jacobi.c stencil.c timing.c -o jacobi -lm
+*/
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "mpi.h"
+
+//phases of one Jacobi iteration, plus the final output
+enum {
+    PHASE_STENCIL,       //computing new values (and the local diffNorm)
+    PHASE_HALO,          //ghost row exchange, including waiting for it
+    PHASE_REDUCE,        //convergence collective, including waiting for it
+    PHASE_CHECKPOINT,    //starting and finishing checkpoint writes
+    PHASE_BALANCE,       //measuring the ranks and migrating rows (jacobi.c balance=N)
+    PHASE_OUTPUT,        //writing the result files
+    PHASE_COUNT
+};
+
+//add the time elapsed since "since" to a phase and return the current time,
+//so consecutive phases can be chained: mark = phaseMark(phaseTime, PHASE_HALO, mark);
+static inline double phaseMark(double* phaseTime, int phase, double since) {
+    double now = MPI_Wtime();
+    phaseTime[phase] += now - since;
+    return now;
+}
+
+//gather the phase totals of all ranks; the master prints a short summary and writes
+//fileName in the given format ("csv" or "json"). Collective over MPI_COMM_WORLD.
+void timingReport(const double* phaseTime, int iterations, const char* format, const char* fileName);
+
+#endif